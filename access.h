@@ -0,0 +1,170 @@
+/* Variable access
+
+eval reads variable id as args[id], so it takes any argument with such an
+operator[]. The accessors here read points in place from common layouts,
+without first copying every point into an array of all variables:
+
+  Columns<T>           structure of arrays: variable id of point i is
+                       columns[id][i]
+  Strided<T>           an array of T: variable id of point i is
+                       base[i * stride + offset[id]], which covers records of
+                       doubles (array of structures) as well as the rows or
+                       columns of a matrix
+  Fields<Record, T>    an array of structs: variable id of point i is the
+                       member field[id] of records[i]
+
+point(i) of an accessor gives point i for eval. For batched evaluation,
+column(id, start, len, buffer) gives the values of variable id for the points
+[start, start + len): a pointer into the data where they are contiguous, the
+buffer filled with them where they are not. AccessEval<Kernel>::evalBatch
+evaluates the points of any accessor a tile at a time this way.
+
+An own accessor needs a Scalar type, value(i, id) and column( ) for the
+batched evaluation, and point(i) for eval, which can be a Point<Accessor>.
+For eval alone any type with an operator[] will do.
+*/
+
+#pragma once
+
+#include "expression.h"
+
+#include <cstddef>
+#include <string>
+
+
+// point i of accessor Accessor, for eval
+template <typename Accessor>
+struct Point {
+  const Accessor &access;
+  std::size_t i;
+
+  typename Accessor::Scalar operator[](unsigned int id) const {
+    return access.value(i, id);
+  }
+};
+
+
+// structure of arrays: variable id of point i is columns[id][i], unused
+// columns can be null
+template <typename T>
+struct Columns {
+  typedef T Scalar;
+
+  const T *const *columns;
+
+  T value(std::size_t i, unsigned int id) const {
+    return columns[id][i];
+  }
+
+  Point<Columns> point(std::size_t i) const {
+    Point<Columns> result = {*this, i};
+    return result;
+  }
+
+  const T *column(unsigned int id, std::size_t start, std::size_t len, T *buffer) const {
+    return columns[id] ? columns[id] + start : nullptr;
+  }
+};
+
+
+// variable id of point i is base[i * stride + offset[id]], variables with a
+// negative offset are not in the data; for instance rows of 4 doubles with x,
+// y and z in the fields 0, 1 and 3 are {base, 4, {0, 1, 3}}, and the columns
+// x, y and z of a column-major matrix with leading dimension ld are
+// {base, 1, {0, ld, 2 * ld}}
+template <typename T>
+struct Strided {
+  typedef T Scalar;
+
+  const T *base;
+  std::size_t stride;
+  std::ptrdiff_t offset[VARS_count];
+
+  T value(std::size_t i, unsigned int id) const {
+    return base[i * stride + offset[id]];
+  }
+
+  Point<Strided> point(std::size_t i) const {
+    Point<Strided> result = {*this, i};
+    return result;
+  }
+
+  const T *column(unsigned int id, std::size_t start, std::size_t len, T *buffer) const {
+    if (offset[id] < 0) {
+      return nullptr;
+    }
+
+    const T *first = base + start * stride + offset[id];
+    if (stride == 1) {
+      return first;
+    }
+
+    for (std::size_t i = 0; i < len; ++i) {
+      buffer[i] = first[i * stride];
+    }
+    return buffer;
+  }
+};
+
+
+// array of structs: variable id of point i is records[i].*field[id], variables
+// with a null field are not in the records; for instance
+// {particles, {&Particle::x, &Particle::y, &Particle::z}}
+template <typename Record, typename T = double>
+struct Fields {
+  typedef T Scalar;
+
+  const Record *records;
+  T Record::*field[VARS_count];
+
+  T value(std::size_t i, unsigned int id) const {
+    return records[i].*field[id];
+  }
+
+  Point<Fields> point(std::size_t i) const {
+    Point<Fields> result = {*this, i};
+    return result;
+  }
+
+  const T *column(unsigned int id, std::size_t start, std::size_t len, T *buffer) const {
+    if (!field[id]) {
+      return nullptr;
+    }
+
+    for (std::size_t i = 0; i < len; ++i) {
+      buffer[i] = records[start + i].*field[id];
+    }
+    return buffer;
+  }
+};
+
+
+// batched evaluation of the points of an accessor with any kernel providing
+//   static void evalBatch(const T *const *vars, std::size_t n, T *out)
+// such as the expressions themselves or SimdEval<E>; the columns of every
+// tile of points are gathered into a buffer that stays in cache, unless they
+// are contiguous already
+template <typename Kernel>
+struct AccessEval {
+  template <typename Accessor>
+  static void evalBatch(const Accessor &access, std::size_t n,
+                        typename Accessor::Scalar *out) {
+    typedef typename Accessor::Scalar T;
+    T buffer[VARS_count][EVAL_TILE];
+    const T *tile[VARS_count];
+
+    for (std::size_t start = 0; start < n; start += EVAL_TILE) {
+      std::size_t len = n - start < EVAL_TILE ? n - start : EVAL_TILE;
+
+      for (unsigned int id = 0; id < VARS_count; ++id) {
+        tile[id] = access.column(id, start, len, buffer[id]);
+      }
+
+      Kernel::evalBatch(tile, len, out + start);
+    }
+  }
+
+  static std::string toString(void) {
+    return Kernel::toString();
+  }
+};
@@ -0,0 +1,850 @@
+// Benchmark of the run-time evaluation of expressions
+//
+// Every expression is evaluated in several forms (as written, simplified,
+// lowered, as polynomials, derived, interpreted as bytecode, generated as C++
+// source, written by hand) over the same points, for several batch
+// sizes. Batch size 1 evaluates point by point with eval( ), larger batch sizes pass
+// that many points at a time to evalBatch( ). Reported are nanoseconds and
+// millions of points per second, and where the perf counters of the kernel can
+// be read (Linux) also cycles and instructions per point.
+//
+// The minimizers of optimize.h are measured on a Rosenbrock function and a sum
+// of exponentials from many starting points, with the value and gradient evaluated in one sweep, as
+// separate derivatives (the way it is written by hand), and in reverse mode.
+// Reported are nanoseconds and millions of iterations per second, and the
+// mean number of iterations per start.
+//
+// Printing the text of an expression is measured as built at compile time
+// (toString( ), written into a buffer and streamed) and as concatenated at
+// run time. Reported are nanoseconds and millions of texts per second, and the
+// length of the text.
+//
+// Given a scratch file, also the streaming evaluation of stream.h is measured:
+// the points are written there, evicted from the page cache and evaluated
+// from disk, once as records and once as columns. Reported are nanoseconds and
+// millions of points per second, and megabytes read and written per second,
+// until the results are on disk.
+//
+// Usage: benchmark [seconds per measurement, default 0.1] [scratch file]
+
+#include "expression.h"
+#include "simplify.h"
+#include "derivative.h"
+#include "cse.h"
+#include "hessian.h"
+#include "lower.h"
+#include "polynomial.h"
+#include "bytecode.h"
+#include "simd.h"
+#include "stream.h"
+#include "gradient.h"
+#include "optimize.h"
+#include "benchmark.h"
+#include "generated.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+// number of points all forms are evaluated on
+enum { BENCH_POINTS = 16384 };
+
+// number of starting points of the minimizers
+enum { MINIMIZE_BENCH_STARTS = 1024 };
+
+// number of points in the file of the streaming benchmark, 512 MB as records
+enum { STREAM_BENCH_POINTS = 1 << 24 };
+
+
+// cycles and instructions spent by this thread, when the kernel allows it
+class PerfCounters {
+public:
+  PerfCounters(void) {
+    cycles = open(PERF_COUNT_HW_CPU_CYCLES, -1);
+    instructions = open(PERF_COUNT_HW_INSTRUCTIONS, cycles);
+  }
+
+  ~PerfCounters(void) {
+#ifdef __linux__
+    if (instructions >= 0) {
+      close(instructions);
+    }
+    if (cycles >= 0) {
+      close(cycles);
+    }
+#endif
+  }
+
+  bool available(void) const {
+    return cycles >= 0 && instructions >= 0;
+  }
+
+  void start(void) {
+#ifdef __linux__
+    if (available()) {
+      ioctl(cycles, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(cycles, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+  }
+
+  // reads the counts since start( ) into the arguments
+  void stop(unsigned long long &cycleCount, unsigned long long &instructionCount) {
+    cycleCount = 0;
+    instructionCount = 0;
+#ifdef __linux__
+    if (available()) {
+      ioctl(cycles, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+      if (read(cycles, &cycleCount, sizeof(cycleCount)) != sizeof(cycleCount) ||
+          read(instructions, &instructionCount, sizeof(instructionCount)) != sizeof(instructionCount)) {
+        cycleCount = 0;
+        instructionCount = 0;
+      }
+    }
+#endif
+  }
+
+private:
+  static int open(unsigned long long config, int group) {
+#ifdef __linux__
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = group < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+#else
+    return -1;
+#endif
+  }
+
+  int cycles;
+  int instructions;
+};
+
+
+// the points to evaluate on, as columns for evalBatch( ) and as rows for eval( )
+struct Points {
+  std::vector<double> columns[VARS_count];
+  std::vector<double> rows;
+
+  Points(void) : rows(BENCH_POINTS * VARS_count) {
+    for (unsigned int id = 0; id < VARS_count; ++id) {
+      columns[id].resize(BENCH_POINTS);
+    }
+
+    // values in [0.5, 2.5), away from the poles of log, sqrt and division
+    unsigned int state = 12345;
+    for (std::size_t i = 0; i < BENCH_POINTS; ++i) {
+      for (unsigned int id = 0; id < VARS_count; ++id) {
+        state = state * 1103515245u + 12345u;
+        double value = 0.5 + 2. * ((state >> 8) & 0xffff) / 65536.;
+        columns[id][i] = value;
+        rows[i * VARS_count + id] = value;
+      }
+    }
+  }
+};
+
+
+// adapters giving forms that only evaluate point by point an evalBatch( ) as well
+template <typename F>
+struct PointByPoint {
+  static double eval(const double *args) {
+    return F::eval(args);
+  }
+
+  static void evalBatch(const double *const *vars, std::size_t n, double *out) {
+    double args[VARS_count];
+    for (std::size_t i = 0; i < n; ++i) {
+      for (unsigned int id = 0; id < VARS_count; ++id) {
+        args[id] = vars[id][i];
+      }
+      out[i] = F::eval(args);
+    }
+  }
+};
+
+// hand-written forms: F::f(x, y, z) written out in plain C++
+template <typename F>
+struct Handwritten {
+  static double eval(const double *args) {
+    return F::f(args[VARS_x], args[VARS_y], args[VARS_z]);
+  }
+
+  static void evalBatch(const double *const *vars, std::size_t n, double *out) {
+    const double *x = vars[VARS_x];
+    const double *y = vars[VARS_y];
+    const double *z = vars[VARS_z];
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = F::f(x[i], y[i], z[i]);
+    }
+  }
+};
+
+// SIMD evaluation point by point is not what it is meant for, so batch size 1
+// uses the scalar evaluation
+template <typename E>
+struct Simd {
+  static double eval(const double *args) {
+    return E::eval(args);
+  }
+
+  static void evalBatch(const double *const *vars, std::size_t n, double *out) {
+    SimdEval<E>::evalBatch(vars, n, out);
+  }
+};
+
+// E as a bytecode program run by the interpreter
+template <typename E>
+struct Interpreted {
+  static const Bytecode &program(void) {
+    static const Bytecode compiled = ToBytecode<E>::run();
+    return compiled;
+  }
+
+  static double eval(const double *args) {
+    return Interpreter::eval(program(), args);
+  }
+
+  static void evalBatch(const double *const *vars, std::size_t n, double *out) {
+    Interpreter::evalBatch(program(), vars, n, out);
+  }
+};
+
+// kernels written out as plain C++ ahead of time by generate.cpp
+template <double (*Scalar)(const double *),
+          void (*Batch)(const double *const *, std::size_t, double *)>
+struct Generated {
+  static double eval(const double *args) {
+    return Scalar(args);
+  }
+
+  static void evalBatch(const double *const *vars, std::size_t n, double *out) {
+    Batch(vars, n, out);
+  }
+};
+
+// derivative with respect to Var<I> as the tangent of a dual number
+template <typename E, unsigned int I>
+struct DualTangent {
+  static double eval(const double *args) {
+    double dir[VARS_count] = {};
+    dir[I] = 1.;
+    return E::evalDual(args, dir).tangent;
+  }
+};
+
+// all second derivatives with the fused Hessian, summed to a single number
+template <typename E>
+struct HessianSum {
+  static double eval(const double *args) {
+    double hessian[VARS_count * VARS_count];
+    Hessian<E>::eval(args, hessian);
+
+    double sum = 0;
+    for (unsigned int i = 0; i < VARS_count * VARS_count; ++i) {
+      sum += hessian[i];
+    }
+    return sum;
+  }
+};
+
+// the entries of the Hessian from entry (I, J) on as separate nested derivatives
+template <typename E, unsigned int I = 0, unsigned int J = 0>
+struct NestedHessian {
+  static void eval(const double *args, double *hessian) {
+    double value = SecondDerivative<E, I, J>::Result::eval(args);
+    hessian[I * VARS_count + J] = value;
+    hessian[J * VARS_count + I] = value;
+    NestedHessian<E, I, J + 1>::eval(args, hessian);
+  }
+};
+
+template <typename E, unsigned int I>
+struct NestedHessian<E, I, VARS_count> {
+  static void eval(const double *args, double *hessian) {
+    NestedHessian<E, I + 1, I + 1>::eval(args, hessian);
+  }
+};
+
+template <typename E>
+struct NestedHessian<E, VARS_count, VARS_count> {
+  static void eval(const double *args, double *hessian) {}
+};
+
+template <typename E>
+struct NestedHessianSum {
+  static double eval(const double *args) {
+    double hessian[VARS_count * VARS_count];
+    NestedHessian<E>::eval(args, hessian);
+
+    double sum = 0;
+    for (unsigned int i = 0; i < VARS_count * VARS_count; ++i) {
+      sum += hessian[i];
+    }
+    return sum;
+  }
+};
+
+
+// value and gradient as separate expressions, every one evaluated on its own
+template <typename E>
+struct SeparateGradient {
+  typedef typename Simplify<E>::Result F;
+
+  static double eval(const double *x, double *grad) {
+    grad[VARS_x] = Derivative<F, Var<VARS_x>>::Result::eval(x);
+    grad[VARS_y] = Derivative<F, Var<VARS_y>>::Result::eval(x);
+    grad[VARS_z] = Derivative<F, Var<VARS_z>>::Result::eval(x);
+    return F::eval(x);
+  }
+};
+
+// value and gradient in reverse mode
+template <typename E>
+struct ReverseGradient {
+  static double eval(const double *x, double *grad) {
+    return Gradient<typename Simplify<E>::Result>::eval(x, grad);
+  }
+};
+
+
+// measuring
+
+volatile double sink;
+
+// evaluates all points with the given batch size at least once and for at
+// least the given time, prints one line of results
+template <typename Kernel>
+void measure(const char *name, const char *form, const Points &points,
+             std::size_t batch, double seconds, PerfCounters &counters) {
+  std::vector<double> out(BENCH_POINTS);
+  const double *columns[VARS_count];
+
+  typedef std::chrono::steady_clock Clock;
+  unsigned long long rounds = 0;
+  unsigned long long cycles = 0, instructions = 0;
+  Clock::time_point begin = Clock::now();
+  Clock::time_point now = begin;
+
+  counters.start();
+  while (rounds == 0 || std::chrono::duration<double>(now - begin).count() < seconds) {
+    if (batch == 1) {
+      for (std::size_t i = 0; i < BENCH_POINTS; ++i) {
+        out[i] = Kernel::eval(&points.rows[i * VARS_count]);
+      }
+    } else {
+      for (std::size_t start = 0; start < BENCH_POINTS; start += batch) {
+        std::size_t n = BENCH_POINTS - start < batch ? BENCH_POINTS - start : batch;
+        for (unsigned int id = 0; id < VARS_count; ++id) {
+          columns[id] = &points.columns[id][start];
+        }
+        Kernel::evalBatch(columns, n, &out[start]);
+      }
+    }
+    sink = out[rounds % BENCH_POINTS];
+    ++rounds;
+    now = Clock::now();
+  }
+  counters.stop(cycles, instructions);
+
+  double total = (double) rounds * BENCH_POINTS;
+  double ns = std::chrono::duration<double, std::nano>(now - begin).count() / total;
+
+  std::cout << std::left << std::setw(16) << name << std::setw(16) << form
+            << std::right << std::setw(7) << batch
+            << std::fixed << std::setprecision(2) << std::setw(11) << ns
+            << std::setw(11) << 1e3 / ns;
+  if (counters.available()) {
+    std::cout << std::setw(11) << cycles / total << std::setw(11) << instructions / total;
+  } else {
+    std::cout << std::setw(11) << "-" << std::setw(11) << "-";
+  }
+  std::cout << std::endl;
+}
+
+// measure( ) for all batch sizes
+template <typename Kernel>
+void measureBatches(const char *name, const char *form, const Points &points,
+                    double seconds, PerfCounters &counters) {
+  const std::size_t batches[] = {1, 16, 256, 4096};
+  for (unsigned int i = 0; i < sizeof(batches) / sizeof(batches[0]); ++i) {
+    measure<Kernel>(name, form, points, batches[i], seconds, counters);
+  }
+}
+
+
+// minimizes from the first starts of the points, again and again for at least
+// the given time, with the pool unless it is null; prints one line of results
+template <typename Minimizer>
+void measureMinimize(const char *name, const char *form, const Points &points,
+                     double seconds, WorkStealingPool *pool) {
+  std::vector<double> starts[VARS_count];
+  double *vars[VARS_count];
+  for (unsigned int id = 0; id < VARS_count; ++id) {
+    starts[id].resize(MINIMIZE_BENCH_STARTS);
+    vars[id] = starts[id].data();
+  }
+  std::vector<double> values(MINIMIZE_BENCH_STARTS);
+  std::vector<unsigned int> iterations(MINIMIZE_BENCH_STARTS);
+
+  typedef std::chrono::steady_clock Clock;
+  unsigned long long rounds = 0, total = 0;
+  double elapsed = 0.;
+
+  while (rounds == 0 || elapsed < seconds) {
+    for (unsigned int id = 0; id < VARS_count; ++id) {
+      std::copy(points.columns[id].begin(), points.columns[id].begin() + MINIMIZE_BENCH_STARTS,
+                starts[id].begin());
+    }
+
+    Clock::time_point begin = Clock::now();
+    if (pool) {
+      Minimizer::runBatch(*pool, vars, MINIMIZE_BENCH_STARTS, values.data(), iterations.data());
+    } else {
+      Minimizer::runBatch(vars, MINIMIZE_BENCH_STARTS, values.data(), iterations.data());
+    }
+    elapsed += std::chrono::duration<double>(Clock::now() - begin).count();
+
+    for (std::size_t i = 0; i < MINIMIZE_BENCH_STARTS; ++i) {
+      total += iterations[i];
+    }
+    sink = values[rounds % MINIMIZE_BENCH_STARTS];
+    ++rounds;
+  }
+
+  double ns = elapsed * 1e9 / total;
+  std::cout << std::left << std::setw(16) << name << std::setw(24) << form
+            << std::right << std::fixed << std::setprecision(2)
+            << std::setw(11) << ns << std::setw(11) << 1e3 / ns
+            << std::setw(11) << (double) total / rounds / MINIMIZE_BENCH_STARTS << std::endl;
+}
+
+void measureMinimizers(const Points &points, double seconds) {
+  std::cout << std::endl << std::left << std::setw(16) << "minimize" << std::setw(24) << "gradient"
+            << std::right << std::setw(11) << "ns/iter" << std::setw(11) << "Miter/s"
+            << std::setw(11) << "iter/start" << std::endl;
+
+  measureMinimize<Minimize<Rosenbrock>>("rosenbrock", "lbfgs fused", points, seconds, nullptr);
+  measureMinimize<Minimize<Rosenbrock, LBFGS<>, SeparateGradient<Rosenbrock>>>(
+      "rosenbrock", "lbfgs separate", points, seconds, nullptr);
+  measureMinimize<Minimize<Rosenbrock, LBFGS<>, ReverseGradient<Rosenbrock>>>(
+      "rosenbrock", "lbfgs reverse", points, seconds, nullptr);
+
+  typedef Minimize<Exponentials> Fused;
+  measureMinimize<Fused>("exponentials", "lbfgs fused", points, seconds, nullptr);
+  measureMinimize<Minimize<Exponentials, LBFGS<>, SeparateGradient<Exponentials>>>(
+      "exponentials", "lbfgs separate", points, seconds, nullptr);
+  measureMinimize<Minimize<Exponentials, LBFGS<>, ReverseGradient<Exponentials>>>(
+      "exponentials", "lbfgs reverse", points, seconds, nullptr);
+  measureMinimize<Minimize<Exponentials, GradientDescent>>(
+      "exponentials", "descent fused", points, seconds, nullptr);
+  measureMinimize<Minimize<Exponentials, GradientDescent, SeparateGradient<Exponentials>>>(
+      "exponentials", "descent separate", points, seconds, nullptr);
+
+  WorkStealingPool pool;
+  std::string threads = "lbfgs fused " + std::to_string(pool.size()) + " threads";
+  measureMinimize<Fused>("exponentials", threads.c_str(), points, seconds, &pool);
+}
+
+
+// printing expressions
+
+// a stream buffer over a fixed array, so that writing to the stream does not
+// allocate
+struct ArrayBuffer : std::streambuf {
+  ArrayBuffer(char *begin, char *end) {
+    setp(begin, end);
+  }
+
+  std::size_t rewind(void) {
+    std::size_t written = pptr() - pbase();
+    setp(pbase(), epptr());
+    return written;
+  }
+};
+
+// the text of E concatenated at run time node by node with std::string, as
+// toString( ) did before the text was built at compile time
+template <typename E>
+struct Concatenation;
+
+template <int N, int D>
+struct Concatenation<Const<N, D>> {
+  static std::string run(void) {
+    if (D == 1) {
+      return std::to_string(N);
+    }
+    return "( " + std::to_string(N) + " / " + std::to_string(D) + " )";
+  }
+};
+
+template <unsigned int id>
+struct Concatenation<Var<id>> {
+  static std::string run(void) {
+    return varname(id);
+  }
+};
+
+template <>
+struct Concatenation<NumE> {
+  static std::string run(void) {
+    return "e";
+  }
+};
+
+template <>
+struct Concatenation<NumPi> {
+  static std::string run(void) {
+    return "pi";
+  }
+};
+
+template <typename E>
+struct Concatenation<Neg<E>> {
+  static std::string run(void) {
+    return "( - " + Concatenation<E>::run() + " )";
+  }
+};
+
+template <typename E>
+struct Concatenation<Sqrt<E>> {
+  static std::string run(void) {
+    return "sqrt( " + Concatenation<E>::run() + " )";
+  }
+};
+
+template <typename E>
+struct Concatenation<Log<E>> {
+  static std::string run(void) {
+    return "log( " + Concatenation<E>::run() + " )";
+  }
+};
+
+template <typename LHS, typename RHS>
+std::string concatenateBinary(const char *op) {
+  return "( " + Concatenation<LHS>::run() + " " + op + " " + Concatenation<RHS>::run() + " )";
+}
+
+template <typename LHS, typename RHS>
+struct Concatenation<Add<LHS, RHS>> {
+  static std::string run(void) {
+    return concatenateBinary<LHS, RHS>("+");
+  }
+};
+
+template <typename LHS, typename RHS>
+struct Concatenation<Sub<LHS, RHS>> {
+  static std::string run(void) {
+    return concatenateBinary<LHS, RHS>("-");
+  }
+};
+
+template <typename LHS, typename RHS>
+struct Concatenation<Mul<LHS, RHS>> {
+  static std::string run(void) {
+    return concatenateBinary<LHS, RHS>("*");
+  }
+};
+
+template <typename LHS, typename RHS>
+struct Concatenation<Div<LHS, RHS>> {
+  static std::string run(void) {
+    return concatenateBinary<LHS, RHS>("/");
+  }
+};
+
+template <typename LHS, typename RHS>
+struct Concatenation<Exp<LHS, RHS>> {
+  static std::string run(void) {
+    return concatenateBinary<LHS, RHS>("^");
+  }
+};
+
+template <typename A, typename B, typename C>
+struct Concatenation<Fma<A, B, C>> {
+  static std::string run(void) {
+    return "fma( " + Concatenation<A>::run() + ", " + Concatenation<B>::run() + ", " +
+           Concatenation<C>::run() + " )";
+  }
+};
+
+template <typename E>
+struct ConcatenatedText {
+  std::size_t operator()(char *buffer, std::size_t size) {
+    return Concatenation<E>::run().size();
+  }
+};
+
+template <typename E>
+struct StringText {
+  std::size_t operator()(char *buffer, std::size_t size) {
+    return E::toString().size();
+  }
+};
+
+template <typename E>
+struct WrittenText {
+  std::size_t operator()(char *buffer, std::size_t size) {
+    return writeText<E>(buffer, size);
+  }
+};
+
+template <typename E>
+struct StreamedText {
+  StreamedText(void) : buffer(text, text + sizeof(text)), stream(&buffer) {}
+
+  std::size_t operator()(char *, std::size_t) {
+    stream << Text<E>();
+    return buffer.rewind();
+  }
+
+  char text[1 << 16];
+  ArrayBuffer buffer;
+  std::ostream stream;
+};
+
+// prints the text of an expression with print(buffer, size) at least once and
+// for at least the given time, prints one line of results
+template <typename Print>
+void measureText(const char *name, const char *form, double seconds) {
+  static char buffer[1 << 16];
+  Print print;
+
+  typedef std::chrono::steady_clock Clock;
+  unsigned long long rounds = 0, chars = 0;
+  Clock::time_point begin = Clock::now();
+  Clock::time_point now = begin;
+
+  while (rounds == 0 || std::chrono::duration<double>(now - begin).count() < seconds) {
+    for (unsigned int k = 0; k < 64; ++k) {
+      chars += print(buffer, sizeof(buffer));
+    }
+    sink = buffer[rounds % 16];
+    rounds += 64;
+    now = Clock::now();
+  }
+
+  double ns = std::chrono::duration<double, std::nano>(now - begin).count() / rounds;
+  std::cout << std::left << std::setw(16) << name << std::setw(24) << form
+            << std::right << std::fixed << std::setprecision(2)
+            << std::setw(11) << ns << std::setw(11) << 1e3 / ns
+            << std::setw(11) << chars / rounds << std::endl;
+}
+
+template <typename E>
+void measureTexts(const char *name, double seconds) {
+  measureText<ConcatenatedText<E>>(name, "concatenated", seconds);
+  measureText<StringText<E>>(name, "toString", seconds);
+  measureText<WrittenText<E>>(name, "writeText", seconds);
+  measureText<StreamedText<E>>(name, "stream", seconds);
+}
+
+
+// streaming
+
+// writes a file of the doubles that item(i, buffer) appends for 0 <= i < count,
+// and evicts it from the page cache so that reading it goes to the disk
+template <typename Item>
+void writeUncached(const std::string &path, std::size_t count, const Item &item) {
+  std::FILE *file = std::fopen(path.c_str(), "wb");
+  if (!file) {
+    throw std::runtime_error("cannot write " + path);
+  }
+
+  std::vector<double> buffer;
+  for (std::size_t i = 0; i < count; ++i) {
+    item(i, buffer);
+    if (buffer.size() * sizeof(double) >= (1 << 20) || i + 1 == count) {
+      std::fwrite(buffer.data(), sizeof(double), buffer.size(), file);
+      buffer.clear();
+    }
+  }
+
+  std::fflush(file);
+  fdatasync(fileno(file));
+  posix_fadvise(fileno(file), 0, 0, POSIX_FADV_DONTNEED);
+  std::fclose(file);
+}
+
+// evaluates the scratch file from disk into the output and waits for the
+// results to be on disk as well, prints one line of results
+template <typename Kernel>
+void measureStream(const char *name, const char *form, const std::string &input,
+                   const StreamLayout &layout, const std::string &output,
+                   WorkStealingPool &pool) {
+  typedef std::chrono::steady_clock Clock;
+  Clock::time_point begin = Clock::now();
+
+  std::size_t n = StreamEval<Kernel>::evalFile(pool, input, layout, output);
+  int results = open(output.c_str(), O_RDONLY);
+  fdatasync(results);
+  close(results);
+
+  double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+  std::size_t fields = 0;
+  for (unsigned int id = 0; id < VARS_count; ++id) {
+    fields += layout.field[id] >= 0;
+  }
+  double bytes = (double) n * ((layout.order == STREAM_RECORDS ? layout.fields : fields) + 1) *
+                 sizeof(double);
+
+  std::cout << std::left << std::setw(16) << name << std::setw(16) << form
+            << std::right << std::fixed << std::setprecision(2)
+            << std::setw(11) << seconds * 1e9 / n << std::setw(11) << n / seconds / 1e6
+            << std::setw(11) << bytes / seconds / 1e6 << std::endl;
+}
+
+void measureStreams(const std::string &scratch, const Points &points) {
+  std::string records = scratch + ".records";
+  std::string columns = scratch + ".columns";
+  std::string output = scratch + ".out";
+
+  // x, y, a field that is not used, z
+  writeUncached(records, STREAM_BENCH_POINTS,
+                [&](std::size_t i, std::vector<double> &buffer) {
+    std::size_t p = i % BENCH_POINTS;
+    buffer.push_back(points.columns[VARS_x][p]);
+    buffer.push_back(points.columns[VARS_y][p]);
+    buffer.push_back(0.);
+    buffer.push_back(points.columns[VARS_z][p]);
+  });
+
+  // the column of x, then those of y and z
+  writeUncached(columns, STREAM_BENCH_POINTS * VARS_count,
+                [&](std::size_t i, std::vector<double> &buffer) {
+    buffer.push_back(points.columns[i / STREAM_BENCH_POINTS][i % BENCH_POINTS]);
+  });
+
+  StreamLayout recordLayout = {STREAM_RECORDS, 4, {0, 1, 3}};
+  StreamLayout columnLayout = {STREAM_COLUMNS, VARS_count, {VARS_x, VARS_y, VARS_z}};
+  WorkStealingPool pool;
+
+  std::cout << std::endl << std::left << std::setw(16) << "expression" << std::setw(16) << "stream"
+            << std::right << std::setw(11) << "ns/point" << std::setw(11) << "Mpoint/s"
+            << std::setw(11) << "MB/s" << std::endl;
+
+  typedef Derivative<Expr4, Var<VARS_z>>::Result Expr4Der;
+  measureStream<SimdEval<Expr4Der>>("d/dz (x+y)^z", "records simd", records, recordLayout, output, pool);
+  measureStream<SimdEval<Expr4Der>>("d/dz (x+y)^z", "columns simd", columns, columnLayout, output, pool);
+
+  std::remove(records.c_str());
+  std::remove(columns.c_str());
+  std::remove(output.c_str());
+}
+
+
+int main(int argc, char **argv) {
+  double seconds = argc > 1 ? std::atof(argv[1]) : 0.1;
+
+  Points points;
+  PerfCounters counters;
+
+  std::cout << "SIMD: " << SIMD_WIDTH << " lanes, perf counters: "
+            << (counters.available() ? "yes" : "no") << std::endl;
+  std::cout << std::left << std::setw(16) << "expression" << std::setw(16) << "form"
+            << std::right << std::setw(7) << "batch" << std::setw(11) << "ns/point"
+            << std::setw(11) << "Mpoint/s" << std::setw(11) << "cyc/point"
+            << std::setw(11) << "ins/point" << std::endl;
+
+  // forms of the main.cpp expressions
+  typedef Simplify<Expr2>::Result Expr2Simp;
+  measureBatches<Expr2>("2x*2x+x", "raw", points, seconds, counters);
+  measureBatches<Expr2Simp>("2x*2x+x", "simplified", points, seconds, counters);
+  measureBatches<Lower<Expr2Simp>::Result>("2x*2x+x", "lowered", points, seconds, counters);
+  measureBatches<Simd<Expr2Simp>>("2x*2x+x", "simplified simd", points, seconds, counters);
+  measureBatches<Handwritten<Expr2ByHand>>("2x*2x+x", "by hand", points, seconds, counters);
+
+  typedef Simplify<Expr3>::Result Expr3Simp;
+  typedef Derivative<Expr3Simp, Var<VARS_x>>::Result Expr3Der;
+  measureBatches<Expr3>("poly", "raw", points, seconds, counters);
+  measureBatches<Expr3Simp>("poly", "simplified", points, seconds, counters);
+  measureBatches<Lower<Expr3Simp, Unfused>::Result>("poly", "lowered unfused", points, seconds, counters);
+  measureBatches<Lower<Expr3Simp, Fused>::Result>("poly", "lowered fused", points, seconds, counters);
+  measureBatches<Polynomials<Expr3Simp>::Result>("poly", "horner", points, seconds, counters);
+  measureBatches<Polynomials<Expr3Simp, Estrin>::Result>("poly", "estrin", points, seconds, counters);
+  measureBatches<Lower<Polynomials<Expr3Simp>::Result, Fused>::Result>("poly", "horner fused", points, seconds, counters);
+  measureBatches<Simd<Polynomials<Expr3Simp>::Result>>("poly", "horner simd", points, seconds, counters);
+  measureBatches<Simd<Expr3Simp>>("poly", "simplified simd", points, seconds, counters);
+  measureBatches<Interpreted<Expr3Simp>>("poly", "bytecode", points, seconds, counters);
+  measureBatches<Generated<generated::expr3Horner, generated::expr3HornerBatch>>("poly", "horner generated", points, seconds, counters);
+  measureBatches<Handwritten<Expr3ByHand>>("poly", "by hand", points, seconds, counters);
+  measureBatches<Expr3Der>("d/dx poly", "derivative", points, seconds, counters);
+  measureBatches<Polynomials<Expr3Der>::Result>("d/dx poly", "horner", points, seconds, counters);
+  measureBatches<PointByPoint<DualTangent<Expr3Simp, VARS_x>>>("d/dx poly", "dual", points, seconds, counters);
+  measureBatches<Handwritten<Expr3DerByHand>>("d/dx poly", "by hand", points, seconds, counters);
+
+  typedef Derivative<Expr4, Var<VARS_z>>::Result Expr4Der;
+  measureBatches<Expr4Der>("d/dz (x+y)^z", "derivative", points, seconds, counters);
+  measureBatches<PointByPoint<CSE<Expr4Der>>>("d/dz (x+y)^z", "derivative cse", points, seconds, counters);
+  measureBatches<Simd<Expr4Der>>("d/dz (x+y)^z", "derivative simd", points, seconds, counters);
+  measureBatches<Interpreted<Expr4Der>>("d/dz (x+y)^z", "bytecode", points, seconds, counters);
+  measureBatches<Generated<generated::expr4Der, generated::expr4DerBatch>>("d/dz (x+y)^z", "generated", points, seconds, counters);
+  measureBatches<PointByPoint<DualTangent<Expr4, VARS_z>>>("d/dz (x+y)^z", "dual", points, seconds, counters);
+  measureBatches<Handwritten<Expr4DerByHand>>("d/dz (x+y)^z", "by hand", points, seconds, counters);
+
+  measureBatches<PointByPoint<NestedHessianSum<Expr4>>>("hess (x+y)^z", "nested", points, seconds, counters);
+  measureBatches<PointByPoint<HessianSum<Expr4>>>("hess (x+y)^z", "hessian", points, seconds, counters);
+
+  // larger generated expressions
+  typedef Monomials<24>::Result Mono;
+  typedef Simplify<Mono>::Result MonoSimp;
+  typedef Derivative<MonoSimp, Var<VARS_x>>::Result MonoDer;
+  measureBatches<Mono>("24 monomials", "raw", points, seconds, counters);
+  measureBatches<MonoSimp>("24 monomials", "simplified", points, seconds, counters);
+  measureBatches<Lower<MonoSimp, Unfused>::Result>("24 monomials", "lowered unfused", points, seconds, counters);
+  measureBatches<Lower<MonoSimp, Fused>::Result>("24 monomials", "lowered fused", points, seconds, counters);
+  measureBatches<Polynomials<MonoSimp>::Result>("24 monomials", "horner", points, seconds, counters);
+  measureBatches<Polynomials<MonoSimp, Estrin>::Result>("24 monomials", "estrin", points, seconds, counters);
+  measureBatches<Simd<MonoSimp>>("24 monomials", "simplified simd", points, seconds, counters);
+  measureBatches<Interpreted<MonoSimp>>("24 monomials", "bytecode", points, seconds, counters);
+  measureBatches<Generated<generated::monoSimp, generated::monoSimpBatch>>("24 monomials", "generated", points, seconds, counters);
+  measureBatches<Handwritten<MonomialsByHand<24>>>("24 monomials", "by hand", points, seconds, counters);
+  measureBatches<MonoDer>("d/dx monomials", "derivative", points, seconds, counters);
+  measureBatches<Generated<generated::monoDer, generated::monoDerBatch>>("d/dx monomials", "generated", points, seconds, counters);
+  measureBatches<PointByPoint<DualTangent<MonoSimp, VARS_x>>>("d/dx monomials", "dual", points, seconds, counters);
+
+  typedef Factors<8>::Result Fact;
+  typedef Simplify<Fact>::Result FactSimp;
+  typedef Derivative<FactSimp, Var<VARS_x>>::Result FactDer;
+  measureBatches<Fact>("8 factors", "raw", points, seconds, counters);
+  measureBatches<FactSimp>("8 factors", "simplified", points, seconds, counters);
+  measureBatches<Handwritten<FactorsByHand<8>>>("8 factors", "by hand", points, seconds, counters);
+  measureBatches<FactDer>("d/dx factors", "derivative", points, seconds, counters);
+  measureBatches<PointByPoint<CSE<FactDer>>>("d/dx factors", "derivative cse", points, seconds, counters);
+  measureBatches<Interpreted<FactDer>>("d/dx factors", "bytecode", points, seconds, counters);
+  measureBatches<Generated<generated::factDer, generated::factDerBatch>>("d/dx factors", "generated", points, seconds, counters);
+  measureBatches<PointByPoint<DualTangent<FactSimp, VARS_x>>>("d/dx factors", "dual", points, seconds, counters);
+
+  measureMinimizers(points, seconds);
+
+  std::cout << std::endl << std::left << std::setw(16) << "print" << std::setw(24) << "text"
+            << std::right << std::setw(11) << "ns/text" << std::setw(11) << "Mtext/s"
+            << std::setw(11) << "chars" << std::endl;
+  measureTexts<Expr3Der>("d/dx poly", seconds);
+  measureTexts<FactDer>("d/dx factors", seconds);
+
+  if (argc > 2) {
+    measureStreams(argv[2], points);
+  }
+
+  return 0;
+}
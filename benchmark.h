@@ -0,0 +1,150 @@
+// The expressions of the benchmark, shared with generate.cpp, and the same
+// functions written by hand
+
+#pragma once
+
+#include "expression.h"
+
+#include <cmath>
+
+
+// expressions built by templates
+
+// sum of N monomials k * v ^ (k % 4 + 1) for k = N .. 1, v cycling through the
+// variables; written with explicit multiplications by 1 and powers of 1 that
+// simplification removes
+template <int N>
+struct Monomials {
+  typedef Add<
+            Mul<
+              Const<N>,
+              Exp<Var<N % VARS_count>, Const<N % 4 + 1>>
+            >,
+            typename Monomials<N - 1>::Result
+          > Result;
+};
+
+template <>
+struct Monomials<1> {
+  typedef Mul<Const<1>, Exp<Var<1>, Const<2>>> Result;
+};
+
+template <int N>
+struct MonomialsByHand {
+  static double f(double x, double y, double z) {
+    double sum = 0;
+    for (int k = N; k >= 1; --k) {
+      double v = k % 3 == 0 ? x : k % 3 == 1 ? y : z;
+      double power = v;
+      for (int p = 1; p < k % 4 + 1; ++p) {
+        power *= v;
+      }
+      sum += k * power;
+    }
+    return sum;
+  }
+};
+
+// product of N factors (v + k) for k = N .. 1, v cycling through the variables
+template <int N>
+struct Factors {
+  typedef Mul<
+            Add<Var<N % VARS_count>, Const<N>>,
+            typename Factors<N - 1>::Result
+          > Result;
+};
+
+template <>
+struct Factors<0> {
+  typedef Const<1> Result;
+};
+
+template <int N>
+struct FactorsByHand {
+  static double f(double x, double y, double z) {
+    double product = 1;
+    for (int k = N; k >= 1; --k) {
+      product *= (k % 3 == 0 ? x : k % 3 == 1 ? y : z) + k;
+    }
+    return product;
+  }
+};
+
+
+// the expressions of main.cpp, see there
+
+// 2x * 2x + x
+typedef Add<
+          Mul<
+            Mul<Const<2>, Var<VARS_x>>,
+            Mul<Const<2>, Var<VARS_x>>
+          >,
+          Var<VARS_x>
+        > Expr2;
+
+struct Expr2ByHand {
+  static double f(double x, double y, double z) {
+    return 4 * x * x + x;
+  }
+};
+
+// 5x^4 + 2x^3 + 6x^2 + x - 5
+typedef Add<
+          Mul<Const<5>, Exp<Var<VARS_x>, Const<4>>>,
+          Add<
+            Mul<Const<2>, Exp<Var<VARS_x>, Const<3>>>,
+            Add<
+              Mul<Const<6>, Exp<Var<VARS_x>, Const<2>>>,
+              Add<Var<VARS_x>, Neg<Const<5>>>
+            >
+          >
+        > Expr3;
+
+struct Expr3ByHand {
+  static double f(double x, double y, double z) {
+    return (((5 * x + 2) * x + 6) * x + 1) * x - 5;
+  }
+};
+
+struct Expr3DerByHand {
+  static double f(double x, double y, double z) {
+    return ((20 * x + 6) * x + 12) * x + 1;
+  }
+};
+
+// (x + y)^z
+typedef Exp<Add<Var<VARS_x>, Var<VARS_y>>, Var<VARS_z>> Expr4;
+
+struct Expr4DerByHand {
+  static double f(double x, double y, double z) {
+    double base = x + y;
+    return std::pow(base, z) * std::log(base);
+  }
+};
+
+
+// Rosenbrock function in three variables, with its minimum 0 at (1, 1, 1):
+// (1 - x)^2 + 100 (y - x^2)^2 + (1 - y)^2 + 100 (z - y^2)^2
+typedef Add<
+          Add<
+            Exp<Sub<Const<1>, Var<VARS_x>>, Const<2>>,
+            Mul<Const<100>, Exp<Sub<Var<VARS_y>, Exp<Var<VARS_x>, Const<2>>>, Const<2>>>
+          >,
+          Add<
+            Exp<Sub<Const<1>, Var<VARS_y>>, Const<2>>,
+            Mul<Const<100>, Exp<Sub<Var<VARS_z>, Exp<Var<VARS_y>, Const<2>>>, Const<2>>>
+          >
+        > Rosenbrock;
+
+// sum of exponentials, with its minimum at (-log(2) / 2, 0, 0):
+// e^(x + 3y - 0.1) + e^(x - 3y - 0.1) + e^(-x - 0.1) + e^z + e^-z
+typedef Add<
+          Add<
+            Exp<NumE, Sub<Add<Var<VARS_x>, Mul<Const<3>, Var<VARS_y>>>, Const<1, 10>>>,
+            Exp<NumE, Sub<Sub<Var<VARS_x>, Mul<Const<3>, Var<VARS_y>>>, Const<1, 10>>>
+          >,
+          Add<
+            Exp<NumE, Sub<Neg<Var<VARS_x>>, Const<1, 10>>>,
+            Add<Exp<NumE, Var<VARS_z>>, Exp<NumE, Neg<Var<VARS_z>>>>
+          >
+        > Exponentials;
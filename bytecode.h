@@ -0,0 +1,575 @@
+/* Bytecode
+
+An expression can also be turned into data instead of code: a short program
+for a register machine, with one instruction per unique node (see cse.h) and
+the constants in a pool. Programs are plain values, so any number of them can
+be created, stored and copied at run-time, and they all share one interpreter
+instead of each instantiating its own evaluation code.
+
+Programs are built with a BytecodeBuilder, either from an expression type with
+ToBytecode<E> or node by node at run-time. The builder merges identical nodes
+and assigns registers such that a register is reused as soon as the value in
+it is no longer needed.
+
+The interpreter jumps from instruction to instruction through a table of
+label addresses (a GCC extension, elsewhere it falls back to a switch). Batches
+of points are evaluated tile by tile (see evalTiled( )) with every instruction
+applied to a whole tile, so the dispatch cost is shared by all points of a
+tile.
+*/
+
+#pragma once
+
+#include "expression.h"
+
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+
+// the instructions, the operands are registers unless noted
+enum Opcode {
+  OP_CONST,  // dst = constants[a]
+  OP_VAR,    // dst = variable a
+  OP_NEG,    // dst = - a
+  OP_SQRT,   // dst = sqrt( a )
+  OP_LOG,    // dst = log( a )
+  OP_ADD,    // dst = a + b
+  OP_SUB,    // dst = a - b
+  OP_MUL,    // dst = a * b
+  OP_DIV,    // dst = a / b
+  OP_POW,    // dst = a ^ b
+  OP_FMA,    // dst = a * b + c, rounded once
+  OP_END     // the result is in register a
+};
+
+struct Instruction {
+  unsigned short op;
+  unsigned short dst;
+  unsigned short a;
+  unsigned short b;
+  unsigned short c;
+};
+
+// a program: the instructions, the constant pool and the number of registers
+// needed to run it
+struct Bytecode {
+  std::vector<Instruction> code;
+  std::vector<double> constants;
+  unsigned int registers;
+};
+
+
+// builds a program from nodes, every node is referred to by the number the
+// builder returns for it
+class BytecodeBuilder {
+public:
+  unsigned int constant(double value) {
+    unsigned long long bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    std::map<unsigned long long, unsigned int>::iterator found = pool.find(bits);
+    unsigned int index;
+    if (found != pool.end()) {
+      index = found->second;
+    } else {
+      index = check(program.constants.size());
+      program.constants.push_back(value);
+      pool[bits] = index;
+    }
+    return node(OP_CONST, index, 0);
+  }
+
+  unsigned int variable(unsigned int id) {
+    return node(OP_VAR, id, 0);
+  }
+
+  unsigned int unary(Opcode op, unsigned int a) {
+    return node(op, a, 0);
+  }
+
+  unsigned int binary(Opcode op, unsigned int a, unsigned int b) {
+    return node(op, a, b);
+  }
+
+  unsigned int ternary(Opcode op, unsigned int a, unsigned int b, unsigned int c) {
+    return node(op, a, b, c);
+  }
+
+  // the program computing node result, the builder starts empty again
+  Bytecode finish(unsigned int result) {
+    // nodes the result does not depend on are left out
+    std::vector<bool> needed(nodes.size(), false);
+    needed[result] = true;
+    for (unsigned int i = result + 1; i-- > 0;) {
+      if (needed[i] && operands(nodes[i].op) >= 1) {
+        needed[nodes[i].a] = true;
+      }
+      if (needed[i] && operands(nodes[i].op) >= 2) {
+        needed[nodes[i].b] = true;
+      }
+      if (needed[i] && operands(nodes[i].op) == 3) {
+        needed[nodes[i].c] = true;
+      }
+    }
+
+    std::vector<unsigned int> lastUse(nodes.size(), 0);
+    for (unsigned int i = 0; i <= result; ++i) {
+      if (needed[i] && operands(nodes[i].op) >= 1) {
+        lastUse[nodes[i].a] = i;
+      }
+      if (needed[i] && operands(nodes[i].op) >= 2) {
+        lastUse[nodes[i].b] = i;
+      }
+      if (needed[i] && operands(nodes[i].op) == 3) {
+        lastUse[nodes[i].c] = i;
+      }
+    }
+
+    // registers are freed after the last instruction reading them, such that
+    // an instruction can write to the register of one of its operands
+    std::vector<unsigned int> reg(nodes.size(), 0);
+    std::vector<unsigned int> free;
+    program.registers = 0;
+
+    for (unsigned int i = 0; i <= result; ++i) {
+      if (!needed[i]) {
+        continue;
+      }
+
+      Instruction instruction = {nodes[i].op, 0, nodes[i].a, nodes[i].b, 0};
+      if (operands(nodes[i].op) >= 1) {
+        instruction.a = reg[nodes[i].a];
+        release(nodes[i].a, i, result, lastUse, reg, free);
+      }
+      if (operands(nodes[i].op) >= 2) {
+        instruction.b = reg[nodes[i].b];
+        if (nodes[i].b != nodes[i].a) {
+          release(nodes[i].b, i, result, lastUse, reg, free);
+        }
+      }
+      if (operands(nodes[i].op) == 3) {
+        instruction.c = reg[nodes[i].c];
+        if (nodes[i].c != nodes[i].a && nodes[i].c != nodes[i].b) {
+          release(nodes[i].c, i, result, lastUse, reg, free);
+        }
+      }
+
+      if (free.empty()) {
+        reg[i] = check(program.registers++);
+      } else {
+        reg[i] = free.back();
+        free.pop_back();
+      }
+      instruction.dst = reg[i];
+      program.code.push_back(instruction);
+    }
+
+    Instruction end = {OP_END, 0, (unsigned short) reg[result], 0, 0};
+    program.code.push_back(end);
+
+    Bytecode done;
+    std::swap(done, program);
+    nodes.clear();
+    known.clear();
+    pool.clear();
+    return done;
+  }
+
+private:
+  struct Node {
+    unsigned short op;
+    unsigned short a;
+    unsigned short b;
+    unsigned short c;
+  };
+
+  static unsigned int operands(unsigned int op) {
+    switch (op) {
+      case OP_CONST:
+      case OP_VAR:
+        return 0;
+      case OP_NEG:
+      case OP_SQRT:
+      case OP_LOG:
+        return 1;
+      case OP_FMA:
+        return 3;
+      default:
+        return 2;
+    }
+  }
+
+  // registers and pool entries are numbered in 16 bits
+  static unsigned int check(std::size_t count) {
+    if (count > 0xffff) {
+      throw std::length_error("bytecode: more than 65536 registers or constants");
+    }
+    return count;
+  }
+
+  unsigned int node(unsigned int op, unsigned int a, unsigned int b, unsigned int c = 0) {
+    unsigned long long key = ((unsigned long long) op << 48) | ((unsigned long long) a << 32)
+                             | (b << 16) | c;
+
+    std::map<unsigned long long, unsigned int>::iterator found = known.find(key);
+    if (found != known.end()) {
+      return found->second;
+    }
+
+    Node created = {(unsigned short) op, (unsigned short) a, (unsigned short) b,
+                    (unsigned short) c};
+    unsigned int index = check(nodes.size());
+    nodes.push_back(created);
+    known[key] = index;
+    return index;
+  }
+
+  static void release(unsigned int operand, unsigned int user, unsigned int result,
+                      const std::vector<unsigned int> &lastUse,
+                      const std::vector<unsigned int> &reg,
+                      std::vector<unsigned int> &free) {
+    if (lastUse[operand] == user && operand != result) {
+      free.push_back(reg[operand]);
+    }
+  }
+
+  Bytecode program;
+  std::vector<Node> nodes;
+  std::map<unsigned long long, unsigned int> known;
+  std::map<unsigned long long, unsigned int> pool;
+};
+
+
+// emits the nodes of expression E into a builder, returns the node of E
+template <typename E>
+struct Emit;
+
+template <int N, int D>
+struct Emit<Const<N, D>> {
+  static unsigned int run(BytecodeBuilder &builder) {
+    return builder.constant(double(N) / D);
+  }
+};
+
+template <unsigned int id>
+struct Emit<Var<id>> {
+  static unsigned int run(BytecodeBuilder &builder) {
+    return builder.variable(id);
+  }
+};
+
+template <>
+struct Emit<NumE> {
+  static unsigned int run(BytecodeBuilder &builder) {
+    return builder.constant(double(NUM_E));
+  }
+};
+
+template <>
+struct Emit<NumPi> {
+  static unsigned int run(BytecodeBuilder &builder) {
+    return builder.constant(double(NUM_PI));
+  }
+};
+
+template <typename E>
+struct Emit<Neg<E>> {
+  static unsigned int run(BytecodeBuilder &builder) {
+    return builder.unary(OP_NEG, Emit<E>::run(builder));
+  }
+};
+
+template <typename E>
+struct Emit<Sqrt<E>> {
+  static unsigned int run(BytecodeBuilder &builder) {
+    return builder.unary(OP_SQRT, Emit<E>::run(builder));
+  }
+};
+
+template <typename E>
+struct Emit<Log<E>> {
+  static unsigned int run(BytecodeBuilder &builder) {
+    return builder.unary(OP_LOG, Emit<E>::run(builder));
+  }
+};
+
+template <typename LHS, typename RHS>
+struct Emit<Add<LHS, RHS>> {
+  static unsigned int run(BytecodeBuilder &builder) {
+    unsigned int lhs = Emit<LHS>::run(builder);
+    return builder.binary(OP_ADD, lhs, Emit<RHS>::run(builder));
+  }
+};
+
+template <typename LHS, typename RHS>
+struct Emit<Sub<LHS, RHS>> {
+  static unsigned int run(BytecodeBuilder &builder) {
+    unsigned int lhs = Emit<LHS>::run(builder);
+    return builder.binary(OP_SUB, lhs, Emit<RHS>::run(builder));
+  }
+};
+
+template <typename LHS, typename RHS>
+struct Emit<Mul<LHS, RHS>> {
+  static unsigned int run(BytecodeBuilder &builder) {
+    unsigned int lhs = Emit<LHS>::run(builder);
+    return builder.binary(OP_MUL, lhs, Emit<RHS>::run(builder));
+  }
+};
+
+template <typename LHS, typename RHS>
+struct Emit<Div<LHS, RHS>> {
+  static unsigned int run(BytecodeBuilder &builder) {
+    unsigned int lhs = Emit<LHS>::run(builder);
+    return builder.binary(OP_DIV, lhs, Emit<RHS>::run(builder));
+  }
+};
+
+template <typename LHS, typename RHS>
+struct Emit<Exp<LHS, RHS>> {
+  static unsigned int run(BytecodeBuilder &builder) {
+    unsigned int lhs = Emit<LHS>::run(builder);
+    return builder.binary(OP_POW, lhs, Emit<RHS>::run(builder));
+  }
+};
+
+template <typename A, typename B, typename C>
+struct Emit<Fma<A, B, C>> {
+  static unsigned int run(BytecodeBuilder &builder) {
+    unsigned int a = Emit<A>::run(builder);
+    unsigned int b = Emit<B>::run(builder);
+    return builder.ternary(OP_FMA, a, b, Emit<C>::run(builder));
+  }
+};
+
+
+// the program of expression E
+template <typename E>
+struct ToBytecode {
+  static Bytecode run(void) {
+    BytecodeBuilder builder;
+    unsigned int result = Emit<E>::run(builder);
+    return builder.finish(result);
+  }
+};
+
+
+// with GCC every instruction jumps to the next one itself, otherwise the
+// instructions are cases of a switch in a loop
+#ifdef __GNUC__
+#define BYTECODE_DISPATCH goto *labels[ip->op];
+#define BYTECODE_CASE(op) label_##op:
+#define BYTECODE_NEXT ++ip; goto *labels[ip->op]
+#else
+#define BYTECODE_DISPATCH for (;;) switch (ip->op)
+#define BYTECODE_CASE(op) case op:
+#define BYTECODE_NEXT ++ip; continue
+#endif
+
+#define BYTECODE_LABELS                                                 \
+  static const void *const labels[] = {                                 \
+    &&label_OP_CONST, &&label_OP_VAR, &&label_OP_NEG, &&label_OP_SQRT,  \
+    &&label_OP_LOG, &&label_OP_ADD, &&label_OP_SUB, &&label_OP_MUL,     \
+    &&label_OP_DIV, &&label_OP_POW, &&label_OP_FMA, &&label_OP_END     \
+  }
+
+struct Interpreter {
+  // value of program at the point args
+  static double eval(const Bytecode &program, const double *args) {
+    double stack[64];
+    std::vector<double> heap;
+    double *r = stack;
+    if (program.registers > 64) {
+      heap.resize(program.registers);
+      r = &heap[0];
+    }
+
+    const double *constants = program.constants.data();
+    const Instruction *ip = program.code.data();
+#ifdef __GNUC__
+    BYTECODE_LABELS;
+#endif
+
+    BYTECODE_DISPATCH {
+      BYTECODE_CASE(OP_CONST) {
+        r[ip->dst] = constants[ip->a];
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_VAR) {
+        r[ip->dst] = args[ip->a];
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_NEG) {
+        r[ip->dst] = - r[ip->a];
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_SQRT) {
+        r[ip->dst] = std::sqrt(r[ip->a]);
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_LOG) {
+        r[ip->dst] = std::log(r[ip->a]);
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_ADD) {
+        r[ip->dst] = r[ip->a] + r[ip->b];
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_SUB) {
+        r[ip->dst] = r[ip->a] - r[ip->b];
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_MUL) {
+        r[ip->dst] = r[ip->a] * r[ip->b];
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_DIV) {
+        r[ip->dst] = r[ip->a] / r[ip->b];
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_POW) {
+        r[ip->dst] = std::pow(r[ip->a], r[ip->b]);
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_FMA) {
+        r[ip->dst] = std::fma(r[ip->a], r[ip->b], r[ip->c]);
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_END) {
+        return r[ip->a];
+      }
+    }
+  }
+
+  // batched evaluation over n points stored as columns, see evalTiled( )
+  static void evalBatch(const Bytecode &program, const double *const *vars,
+                        std::size_t n, double *out) {
+    std::vector<double> registers(program.registers * EVAL_TILE);
+
+    for (std::size_t start = 0; start < n; start += EVAL_TILE) {
+      std::size_t len = n - start;
+      if (len > EVAL_TILE) {
+        len = EVAL_TILE;
+      }
+
+      evalTile(program, vars, start, len, &registers[0], out + start);
+    }
+  }
+
+private:
+  // the points [start, start + len) with registers of EVAL_TILE doubles each
+  static void evalTile(const Bytecode &program, const double *const *vars,
+                       std::size_t start, std::size_t len, double *r, double *out) {
+    const double *constants = program.constants.data();
+    const Instruction *ip = program.code.data();
+#ifdef __GNUC__
+    BYTECODE_LABELS;
+#endif
+
+    BYTECODE_DISPATCH {
+      BYTECODE_CASE(OP_CONST) {
+        double *dst = r + ip->dst * EVAL_TILE;
+        double value = constants[ip->a];
+        for (std::size_t i = 0; i < len; ++i) {
+          dst[i] = value;
+        }
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_VAR) {
+        std::memcpy(r + ip->dst * EVAL_TILE, vars[ip->a] + start, len * sizeof(double));
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_NEG) {
+        double *dst = r + ip->dst * EVAL_TILE;
+        const double *a = r + ip->a * EVAL_TILE;
+        for (std::size_t i = 0; i < len; ++i) {
+          dst[i] = - a[i];
+        }
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_SQRT) {
+        double *dst = r + ip->dst * EVAL_TILE;
+        const double *a = r + ip->a * EVAL_TILE;
+        for (std::size_t i = 0; i < len; ++i) {
+          dst[i] = std::sqrt(a[i]);
+        }
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_LOG) {
+        double *dst = r + ip->dst * EVAL_TILE;
+        const double *a = r + ip->a * EVAL_TILE;
+        for (std::size_t i = 0; i < len; ++i) {
+          dst[i] = std::log(a[i]);
+        }
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_ADD) {
+        double *dst = r + ip->dst * EVAL_TILE;
+        const double *a = r + ip->a * EVAL_TILE;
+        const double *b = r + ip->b * EVAL_TILE;
+        for (std::size_t i = 0; i < len; ++i) {
+          dst[i] = a[i] + b[i];
+        }
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_SUB) {
+        double *dst = r + ip->dst * EVAL_TILE;
+        const double *a = r + ip->a * EVAL_TILE;
+        const double *b = r + ip->b * EVAL_TILE;
+        for (std::size_t i = 0; i < len; ++i) {
+          dst[i] = a[i] - b[i];
+        }
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_MUL) {
+        double *dst = r + ip->dst * EVAL_TILE;
+        const double *a = r + ip->a * EVAL_TILE;
+        const double *b = r + ip->b * EVAL_TILE;
+        for (std::size_t i = 0; i < len; ++i) {
+          dst[i] = a[i] * b[i];
+        }
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_DIV) {
+        double *dst = r + ip->dst * EVAL_TILE;
+        const double *a = r + ip->a * EVAL_TILE;
+        const double *b = r + ip->b * EVAL_TILE;
+        for (std::size_t i = 0; i < len; ++i) {
+          dst[i] = a[i] / b[i];
+        }
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_POW) {
+        double *dst = r + ip->dst * EVAL_TILE;
+        const double *a = r + ip->a * EVAL_TILE;
+        const double *b = r + ip->b * EVAL_TILE;
+        for (std::size_t i = 0; i < len; ++i) {
+          dst[i] = std::pow(a[i], b[i]);
+        }
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_FMA) {
+        double *dst = r + ip->dst * EVAL_TILE;
+        const double *a = r + ip->a * EVAL_TILE;
+        const double *b = r + ip->b * EVAL_TILE;
+        const double *c = r + ip->c * EVAL_TILE;
+        for (std::size_t i = 0; i < len; ++i) {
+          dst[i] = std::fma(a[i], b[i], c[i]);
+        }
+        BYTECODE_NEXT;
+      }
+      BYTECODE_CASE(OP_END) {
+        std::memcpy(out, r + ip->a * EVAL_TILE, len * sizeof(double));
+        return;
+      }
+    }
+  }
+};
+
+#undef BYTECODE_DISPATCH
+#undef BYTECODE_CASE
+#undef BYTECODE_NEXT
+#undef BYTECODE_LABELS
@@ -0,0 +1,324 @@
+/* Source generation
+
+Deep expression types cost compile time in every translation unit that
+evaluates them, and some compilers stop inlining long before the bottom of the
+tree. CodeGen<Es...> writes the evaluation of expressions out as plain C++
+instead: straight-line code with one statement per unique node (see cse.h),
+where every node is a named constant computed once from those before it,
+
+  inline double expr(const double *args) {
+    const double t0 = args[0];
+    const double t1 = args[1];
+    const double t2 = t0 + t1;
+    const double t3 = args[2];
+    const double t4 = std::pow(t2, t3);
+    const double t5 = std::log(t2);
+    const double t6 = t4 * t5;
+    return t6;
+  }
+
+plus a batched version that runs the same statements in a loop over columns
+of points like evalBatch. A program run as a build step writes these into a
+header once, which then compiles quickly wherever it is included. Constants
+are written as literals that read back to exactly the double eval uses, and
+every node is computed with the same operation as eval, so the generated code
+gives the same results as eval (compiled with the same floating point
+options, in particular without contracting a * b + c).
+
+Several expressions give a function with one output per expression, all
+computed in one sweep like a Bundle.
+*/
+
+#pragma once
+
+#include "expression.h"
+#include "cse.h"
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+// the statements of a generated function, in order
+class SourceBuilder {
+public:
+  // variables are read as "<vars>[id]<suffix>"
+  SourceBuilder(const std::string &vars, const std::string &suffix,
+                const std::string &indent)
+      : vars(vars), suffix(suffix), indent(indent), count(0) {}
+
+  // a new constant holding the value of the C++ expression rhs, returns its
+  // name
+  std::string define(const std::string &rhs) {
+    std::string name = "t" + std::to_string(count++);
+    body += indent + "const double " + name + " = " + rhs + ";\n";
+    return name;
+  }
+
+  std::string variable(unsigned int id) const {
+    return vars + "[" + std::to_string(id) + "]" + suffix;
+  }
+
+  void line(const std::string &statement) {
+    body += indent + statement + "\n";
+  }
+
+  const std::string &source(void) const {
+    return body;
+  }
+
+private:
+  std::string vars;
+  std::string suffix;
+  std::string indent;
+  unsigned int count;
+  std::string body;
+};
+
+
+// a double as a C++ literal that reads back to the same double, in
+// parentheses when negative; infinities and NaN, which have no literal, as
+// std::numeric_limits<double>
+inline std::string sourceLiteral(double value) {
+  if (value != value) {
+    return "std::numeric_limits<double>::quiet_NaN()";
+  }
+  if (value == HUGE_VAL || value == -HUGE_VAL) {
+    return value < 0 ? "( - std::numeric_limits<double>::infinity() )"
+                     : "std::numeric_limits<double>::infinity()";
+  }
+
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+
+  std::string result = buffer;
+  if (result.find_first_of(".e") == std::string::npos) {
+    result += ".";
+  }
+  return value < 0 ? "( " + result + " )" : result;
+}
+
+
+// the statements of node E of list L, given the names of the values of the
+// nodes before it; returns the name (or literal) of its value
+
+template <typename E, typename L>
+struct Generate;
+
+template <int N, int D, typename L>
+struct Generate<Const<N, D>, L> {
+  static std::string run(SourceBuilder &source, const std::vector<std::string> &values) {
+    return sourceLiteral(double(N) / D);
+  }
+};
+
+template <typename L>
+struct Generate<NumE, L> {
+  static std::string run(SourceBuilder &source, const std::vector<std::string> &values) {
+    return sourceLiteral(double(NUM_E));
+  }
+};
+
+template <typename L>
+struct Generate<NumPi, L> {
+  static std::string run(SourceBuilder &source, const std::vector<std::string> &values) {
+    return sourceLiteral(double(NUM_PI));
+  }
+};
+
+template <unsigned int id, typename L>
+struct Generate<Var<id>, L> {
+  static std::string run(SourceBuilder &source, const std::vector<std::string> &values) {
+    return source.define(source.variable(id));
+  }
+};
+
+template <typename E, typename L>
+struct Generate<Neg<E>, L> {
+  static std::string run(SourceBuilder &source, const std::vector<std::string> &values) {
+    return source.define("-" + values[IndexOf<L, E>::index]);
+  }
+};
+
+template <typename E, typename L>
+struct Generate<Sqrt<E>, L> {
+  static std::string run(SourceBuilder &source, const std::vector<std::string> &values) {
+    return source.define("std::sqrt(" + values[IndexOf<L, E>::index] + ")");
+  }
+};
+
+template <typename E, typename L>
+struct Generate<Log<E>, L> {
+  static std::string run(SourceBuilder &source, const std::vector<std::string> &values) {
+    return source.define("std::log(" + values[IndexOf<L, E>::index] + ")");
+  }
+};
+
+// the binary operators
+template <typename LHS, typename RHS, typename L>
+std::string generateBinary(SourceBuilder &source, const std::vector<std::string> &values,
+                           const char *op) {
+  return source.define(values[IndexOf<L, LHS>::index] + " " + op + " " +
+                       values[IndexOf<L, RHS>::index]);
+}
+
+template <typename LHS, typename RHS, typename L>
+struct Generate<Add<LHS, RHS>, L> {
+  static std::string run(SourceBuilder &source, const std::vector<std::string> &values) {
+    return generateBinary<LHS, RHS, L>(source, values, "+");
+  }
+};
+
+template <typename LHS, typename RHS, typename L>
+struct Generate<Sub<LHS, RHS>, L> {
+  static std::string run(SourceBuilder &source, const std::vector<std::string> &values) {
+    return generateBinary<LHS, RHS, L>(source, values, "-");
+  }
+};
+
+template <typename LHS, typename RHS, typename L>
+struct Generate<Mul<LHS, RHS>, L> {
+  static std::string run(SourceBuilder &source, const std::vector<std::string> &values) {
+    return generateBinary<LHS, RHS, L>(source, values, "*");
+  }
+};
+
+template <typename LHS, typename RHS, typename L>
+struct Generate<Div<LHS, RHS>, L> {
+  static std::string run(SourceBuilder &source, const std::vector<std::string> &values) {
+    return generateBinary<LHS, RHS, L>(source, values, "/");
+  }
+};
+
+template <typename LHS, typename RHS, typename L>
+struct Generate<Exp<LHS, RHS>, L> {
+  static std::string run(SourceBuilder &source, const std::vector<std::string> &values) {
+    return source.define("std::pow(" + values[IndexOf<L, LHS>::index] + ", " +
+                         values[IndexOf<L, RHS>::index] + ")");
+  }
+};
+
+template <typename A, typename B, typename C, typename L>
+struct Generate<Fma<A, B, C>, L> {
+  static std::string run(SourceBuilder &source, const std::vector<std::string> &values) {
+    return source.define("std::fma(" + values[IndexOf<L, A>::index] + ", " +
+                         values[IndexOf<L, B>::index] + ", " +
+                         values[IndexOf<L, C>::index] + ")");
+  }
+};
+
+
+// walk the nodes still to do front to back, the value of node I of list L
+// goes in values[I]
+template <typename Todo, typename L, unsigned int I = 0>
+struct GenerateSweep;
+
+template <typename L, unsigned int I>
+struct GenerateSweep<NodeList<>, L, I> {
+  static void run(SourceBuilder &source, std::vector<std::string> &values) {}
+};
+
+template <typename Head, typename... Tail, typename L, unsigned int I>
+struct GenerateSweep<NodeList<Head, Tail...>, L, I> {
+  static void run(SourceBuilder &source, std::vector<std::string> &values) {
+    values[I] = Generate<Head, L>::run(source, values);
+    GenerateSweep<NodeList<Tail...>, L, I + 1>::run(source, values);
+  }
+};
+
+
+// C++ source evaluating the expressions Es, to be compiled on its own
+template <typename... Es>
+struct CodeGen {
+  typedef typename Bundle<Es...>::Nodes Nodes;
+
+  enum { outputs = sizeof...(Es) };
+
+  // for a single expression
+  //   double name(const double *args)
+  // otherwise
+  //   void name(const double *args, double *out)
+  // with out[k] set to the value of expression k
+  static std::string scalar(const std::string &name) {
+    SourceBuilder source("args", "", "  ");
+    std::vector<std::string> results = sweep(source);
+
+    std::string head;
+    if (outputs == 1) {
+      head = "inline double " + name + "(const double *args) {\n";
+      source.line("return " + results[0] + ";");
+    } else {
+      head = "inline void " + name + "(const double *args, double *out) {\n";
+      for (unsigned int k = 0; k < outputs; ++k) {
+        source.line("out[" + std::to_string(k) + "] = " + results[k] + ";");
+      }
+    }
+    return head + source.source() + "}\n";
+  }
+
+  // like evalBatch, for a single expression
+  //   void name(const double *const *vars, std::size_t n, double *out)
+  // otherwise
+  //   void name(const double *const *vars, std::size_t n, double *const *out)
+  // with out[k][i] set to the value of expression k at point i
+  static std::string batch(const std::string &name) {
+    SourceBuilder source("vars", "[i]", "    ");
+    std::vector<std::string> results = sweep(source);
+
+    if (outputs == 1) {
+      source.line("out[i] = " + results[0] + ";");
+    } else {
+      for (unsigned int k = 0; k < outputs; ++k) {
+        source.line("out[" + std::to_string(k) + "][i] = " + results[k] + ";");
+      }
+    }
+
+    return "inline void " + name + "(const double *const *vars, std::size_t n, double " +
+           (outputs == 1 ? "*out" : "*const *out") + ") {\n" +
+           "  for (std::size_t i = 0; i < n; ++i) {\n" +
+           source.source() +
+           "  }\n" +
+           "}\n";
+  }
+
+  // both, name and nameBatch, after a comment with the expressions
+  static std::string source(const std::string &name) {
+    const std::string names[] = {Es::toString()...};
+
+    std::string result;
+    for (unsigned int k = 0; k < outputs; ++k) {
+      result += "// " + names[k] + "\n";
+    }
+    return result + scalar(name) + "\n" + batch(name + "Batch");
+  }
+
+private:
+  // the statements of all nodes, returns the names of the values of Es
+  static std::vector<std::string> sweep(SourceBuilder &source) {
+    const unsigned int index[] = {IndexOf<Nodes, Es>::index...};
+
+    std::vector<std::string> values(Nodes::size);
+    GenerateSweep<Nodes, Nodes>::run(source, values);
+
+    std::vector<std::string> results;
+    for (unsigned int k = 0; k < outputs; ++k) {
+      results.push_back(values[index[k]]);
+    }
+    return results;
+  }
+};
+
+
+// a header holding the given generated sources
+inline std::string generatedHeader(const std::string &sources) {
+  return "// Generated by codegen.h, do not edit\n"
+         "\n"
+         "#pragma once\n"
+         "\n"
+         "#include <cmath>\n"
+         "#include <cstddef>\n"
+         "#include <limits>\n"
+         "\n"
+         "\n" + sources;
+}
@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+"""Compile-time benchmark of Simplify and Derivative
+
+Generates expressions of growing size in several families, compiles a small
+translation unit that instantiates Simplify<E> or Derivative<E, Var<0>> for
+each of them, and reports per size:
+
+  wall     wall time of the compiler in seconds
+  inst     template instantiation time from -ftime-report in seconds
+  MB       peak memory of the compiler
+  classes  class templates of the library instantiated (from -fdump-lang-class)
+
+A size that fails to compile or takes longer than the timeout ends its family,
+so scaling cliffs show up as the last line of a family.
+
+Usage: compile_benchmark.py [--compiler g++] [--include DIR] [--out DIR]
+                            [--max-size N] [--timeout SECONDS] [--csv FILE]
+                            [--full]
+"""
+
+import argparse
+import csv
+import glob
+import os
+import re
+import subprocess
+import sys
+import time
+
+
+# expression families: each maps a size to the C++ type of an expression
+
+def var(k):
+    return 'Var<%d>' % (k % 3)
+
+
+def monomials(n):
+    """sum of n monomials k * v ^ (k % 4 + 1): grows in width"""
+    expr = 'Mul<Const<1>, Exp<%s, Const<2>>>' % var(1)
+    for k in range(2, n + 1):
+        expr = 'Add<Mul<Const<%d>, Exp<%s, Const<%d>>>, %s>' % (k, var(k), k % 4 + 1, expr)
+    return expr
+
+
+def products(n):
+    """product of n factors (v + k): grows in depth"""
+    expr = 'Const<1>'
+    for k in range(1, n + 1):
+        expr = 'Mul<Add<%s, Const<%d>>, %s>' % (var(k), k, expr)
+    return expr
+
+
+def chain(n):
+    """n nested functions cycling through ^ 2, log( ) and sqrt( )"""
+    expr = 'Add<Var<0>, Var<1>>'
+    for k in range(n):
+        if k % 3 == 0:
+            expr = 'Exp<%s, Const<2>>' % expr
+        elif k % 3 == 1:
+            expr = 'Log<%s>' % expr
+        else:
+            expr = 'Sqrt<%s>' % expr
+    return expr
+
+
+FAMILIES = [
+    ('monomials', monomials),
+    ('products', products),
+    ('chain', chain),
+]
+
+OPERATIONS = [
+    ('simplify', 'Simplify<%s>::Result'),
+    ('derivative', 'Derivative<Simplify<%s>::Result, Var<0>>::Result'),
+]
+
+# class templates of the library that are counted
+LIBRARY = re.compile(r'^Class (Simplify|Rule|Settle|Derivative|Const|Var|NumE|NumPi|'
+                     r'Neg|Sqrt|Log|Add|Sub|Mul|Div|Exp|IsSame)<')
+
+
+def source(include, operation, expr):
+    return ('#include "%s/derivative.h"\n'
+            '\n'
+            'int main(void) {\n'
+            '  return (int) %s::toString().size();\n'
+            '}\n') % (include, operation % expr)
+
+
+def compile_one(compiler, flags, path, timeout):
+    """compiles path, returns (status, wall, peak MB, stderr)"""
+    # the diagnostics go to a file, a pipe could fill up and stall the compiler
+    log = open(path + '.log', 'w+')
+    begin = time.time()
+    process = subprocess.Popen([compiler] + flags + [path],
+                               stdout=subprocess.DEVNULL,
+                               stderr=log)
+
+    # wait4 gives the peak memory of this compiler run only
+    while True:
+        pid, status, usage = os.wait4(process.pid, os.WNOHANG)
+        if pid:
+            break
+        if time.time() - begin > timeout:
+            process.kill()
+            os.wait4(process.pid, 0)
+            log.close()
+            return 'timeout', time.time() - begin, 0., ''
+        time.sleep(0.01)
+
+    wall = time.time() - begin
+    log.seek(0)
+    stderr = log.read()
+    log.close()
+    return ('ok' if os.waitstatus_to_exitcode(status) == 0 else 'error',
+            wall, usage.ru_maxrss / 1024., stderr)
+
+
+def instantiation_time(report):
+    match = re.search(r'template instantiation\s*:.*?([0-9.]+) \(\s*\d+%\) wall', report)
+    if not match:
+        # older versions list usr, sys and wall without the word wall
+        match = re.search(r'template instantiation\s*:\s*(?:[0-9.]+ \(\s*\d+%\)\s*){2}([0-9.]+)', report)
+    return float(match.group(1)) if match else 0.
+
+
+def count_classes(directory, stem):
+    count = 0
+    for dump in glob.glob(os.path.join(directory, '*%s*.class' % stem)):
+        with open(dump, errors='replace') as f:
+            count += sum(1 for line in f if LIBRARY.match(line))
+        os.remove(dump)
+    return count
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--compiler', default=os.environ.get('CXX', 'g++'))
+    parser.add_argument('--include', default=os.path.dirname(os.path.abspath(__file__)),
+                        help='directory with the headers')
+    parser.add_argument('--out', default='compile_benchmark',
+                        help='directory for the generated sources')
+    parser.add_argument('--max-size', type=int, default=256)
+    parser.add_argument('--timeout', type=float, default=60.,
+                        help='seconds after which a size ends its family')
+    parser.add_argument('--csv', help='also write the results to this file')
+    parser.add_argument('--full', action='store_true',
+                        help='compile with -O2 instead of checking syntax only')
+    args = parser.parse_args()
+
+    if not os.path.isdir(args.out):
+        os.makedirs(args.out)
+
+    flags = ['-std=c++11', '-w', '-ftime-report', '-fdump-lang-class']
+    flags += ['-O2', '-c', '-o', os.devnull] if args.full else ['-fsyntax-only']
+
+    rows = []
+    print('%-12s %-11s %5s %8s %8s %8s %8s  %s'
+          % ('family', 'operation', 'size', 'wall', 'inst', 'MB', 'classes', 'status'))
+    sys.stdout.flush()
+
+    for family, generate in FAMILIES:
+        for operation, pattern in OPERATIONS:
+            size = 1
+            while size <= args.max_size:
+                stem = '%s_%s_%d' % (family, operation, size)
+                path = os.path.join(args.out, stem + '.cpp')
+                with open(path, 'w') as f:
+                    f.write(source(args.include, pattern, generate(size)))
+
+                status, wall, peak, report = compile_one(
+                    args.compiler, flags, os.path.abspath(path), args.timeout)
+                seconds = instantiation_time(report)
+                classes = count_classes(os.getcwd(), stem) + count_classes(args.out, stem)
+
+                if status == 'error':
+                    errors = [l for l in report.splitlines() if 'error' in l]
+                    status = 'error: ' + (errors[0].split('error: ', 1)[-1][:60] if errors else '?')
+
+                print('%-12s %-11s %5d %8.2f %8.2f %8.1f %8d  %s'
+                      % (family, operation, size, wall, seconds, peak, classes, status))
+                sys.stdout.flush()
+                rows.append([family, operation, size, '%.3f' % wall, '%.3f' % seconds,
+                             '%.1f' % peak, classes, status])
+
+                if status != 'ok':
+                    break
+                size *= 2
+
+    if args.csv:
+        with open(args.csv, 'w') as f:
+            writer = csv.writer(f)
+            writer.writerow(['family', 'operation', 'size', 'wall', 'instantiation',
+                             'peak_mb', 'classes', 'status'])
+            writer.writerows(rows)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,445 @@
+/* Common subexpression elimination
+
+The expression tree is flattened at compile time into the list of its unique
+subexpressions, which turns the tree into a DAG. Children always appear before
+their parents in that list, so walking it front to back computes every
+distinct subexpression exactly once into its own slot. The last slot holds the
+value of the whole expression.
+*/
+
+#pragma once
+
+#include "expression.h"
+#include "simplify.h"
+#include "access.h"
+
+#include <memory>
+
+
+// a list of expression types, used to hold the unique nodes of an expression
+template <typename... Es>
+struct NodeList {
+  enum { size = sizeof...(Es) };
+};
+
+
+// whether expression E already is in list L
+template <typename L, typename E>
+struct Contains;
+
+template <typename E>
+struct Contains<NodeList<>, E> {
+  typedef False Answer;
+};
+
+template <typename Head, typename... Tail, typename E>
+struct Contains<NodeList<Head, Tail...>, E> {
+  typedef typename Contains<NodeList<Tail...>, E>::Answer Answer;
+};
+
+template <typename... Tail, typename E>
+struct Contains<NodeList<E, Tail...>, E> {
+  typedef True Answer;
+};
+
+
+// position of expression E in list L (E has to be in the list)
+template <typename L, typename E>
+struct IndexOf;
+
+template <typename Head, typename... Tail, typename E>
+struct IndexOf<NodeList<Head, Tail...>, E> {
+  enum { index = 1 + IndexOf<NodeList<Tail...>, E>::index };
+};
+
+template <typename... Tail, typename E>
+struct IndexOf<NodeList<E, Tail...>, E> {
+  enum { index = 0 };
+};
+
+
+// add expression E to the back of list L
+template <typename L, typename E>
+struct Append;
+
+template <typename... Es, typename E>
+struct Append<NodeList<Es...>, E> {
+  typedef NodeList<Es..., E> Result;
+};
+
+
+// collect the unique nodes of E in post-order and append them to list L
+// when E is already in the list, so are all of its subexpressions
+template <typename E, typename L, typename Found = typename Contains<L, E>::Answer>
+struct Collect {
+  typedef L Result;
+};
+
+// leaves (constants, variables) have no subexpressions
+template <typename E, typename L>
+struct Collect<E, L, False> {
+  typedef typename Append<L, E>::Result Result;
+};
+
+// unary expressions (negation, square root, logarithm)
+template <template <typename> class Op, typename E, typename L>
+struct Collect<Op<E>, L, False> {
+  typedef typename Append<
+            typename Collect<E, L>::Result,
+            Op<E>
+          >::Result Result;
+};
+
+// binary expressions (addition, subtraction, multiplication, division, exponent)
+template <template <typename, typename> class Op, typename LHS, typename RHS, typename L>
+struct Collect<Op<LHS, RHS>, L, False> {
+  typedef typename Append<
+            typename Collect<
+              RHS,
+              typename Collect<LHS, L>::Result
+            >::Result,
+            Op<LHS, RHS>
+          >::Result Result;
+};
+
+// ternary expressions (fused multiply-add)
+template <template <typename, typename, typename> class Op, typename A, typename B, typename C,
+          typename L>
+struct Collect<Op<A, B, C>, L, False> {
+  typedef typename Append<
+            typename Collect<
+              C,
+              typename Collect<
+                B,
+                typename Collect<A, L>::Result
+              >::Result
+            >::Result,
+            Op<A, B, C>
+          >::Result Result;
+};
+
+
+// number of nodes of E as a tree, which is how many nodes eval evaluates
+
+// leaves (constants, variables)
+template <typename E>
+struct TreeSize {
+  enum { size = 1 };
+};
+
+template <template <typename> class Op, typename E>
+struct TreeSize<Op<E>> {
+  enum { size = 1 + TreeSize<E>::size };
+};
+
+template <template <typename, typename> class Op, typename LHS, typename RHS>
+struct TreeSize<Op<LHS, RHS>> {
+  enum { size = 1 + TreeSize<LHS>::size + TreeSize<RHS>::size };
+};
+
+template <template <typename, typename, typename> class Op, typename A, typename B, typename C>
+struct TreeSize<Op<A, B, C>> {
+  enum { size = 1 + TreeSize<A>::size + TreeSize<B>::size + TreeSize<C>::size };
+};
+
+
+// evaluation of a single node, given the slots of its subexpressions in list L
+// the value of slot k is slots[k], for one point or for point i of a tile
+
+// by default the node is a leaf which can be evaluated directly
+template <typename E, typename L>
+struct CseNode {
+  template <typename Slots, typename Args>
+  static typename ScalarOf<Slots>::Type eval(const Slots &slots, const Args &args) {
+    return E::eval(args);
+  }
+};
+
+template <typename E, typename L>
+struct CseNode<Neg<E>, L> {
+  template <typename Slots, typename Args>
+  static typename ScalarOf<Slots>::Type eval(const Slots &slots, const Args &args) {
+    return - slots[IndexOf<L, E>::index];
+  }
+};
+
+template <typename E, typename L>
+struct CseNode<Sqrt<E>, L> {
+  template <typename Slots, typename Args>
+  static typename ScalarOf<Slots>::Type eval(const Slots &slots, const Args &args) {
+    return std::sqrt(slots[IndexOf<L, E>::index]);
+  }
+};
+
+template <typename E, typename L>
+struct CseNode<Log<E>, L> {
+  template <typename Slots, typename Args>
+  static typename ScalarOf<Slots>::Type eval(const Slots &slots, const Args &args) {
+    return std::log(slots[IndexOf<L, E>::index]);
+  }
+};
+
+template <typename LHS, typename RHS, typename L>
+struct CseNode<Add<LHS, RHS>, L> {
+  template <typename Slots, typename Args>
+  static typename ScalarOf<Slots>::Type eval(const Slots &slots, const Args &args) {
+    return slots[IndexOf<L, LHS>::index] + slots[IndexOf<L, RHS>::index];
+  }
+};
+
+template <typename LHS, typename RHS, typename L>
+struct CseNode<Sub<LHS, RHS>, L> {
+  template <typename Slots, typename Args>
+  static typename ScalarOf<Slots>::Type eval(const Slots &slots, const Args &args) {
+    return slots[IndexOf<L, LHS>::index] - slots[IndexOf<L, RHS>::index];
+  }
+};
+
+template <typename LHS, typename RHS, typename L>
+struct CseNode<Mul<LHS, RHS>, L> {
+  template <typename Slots, typename Args>
+  static typename ScalarOf<Slots>::Type eval(const Slots &slots, const Args &args) {
+    return slots[IndexOf<L, LHS>::index] * slots[IndexOf<L, RHS>::index];
+  }
+};
+
+template <typename LHS, typename RHS, typename L>
+struct CseNode<Div<LHS, RHS>, L> {
+  template <typename Slots, typename Args>
+  static typename ScalarOf<Slots>::Type eval(const Slots &slots, const Args &args) {
+    return slots[IndexOf<L, LHS>::index] / slots[IndexOf<L, RHS>::index];
+  }
+};
+
+template <typename LHS, typename RHS, typename L>
+struct CseNode<Exp<LHS, RHS>, L> {
+  template <typename Slots, typename Args>
+  static typename ScalarOf<Slots>::Type eval(const Slots &slots, const Args &args) {
+    return std::pow(slots[IndexOf<L, LHS>::index], slots[IndexOf<L, RHS>::index]);
+  }
+};
+
+template <typename A, typename B, typename C, typename L>
+struct CseNode<Fma<A, B, C>, L> {
+  template <typename Slots, typename Args>
+  static typename ScalarOf<Slots>::Type eval(const Slots &slots, const Args &args) {
+    return std::fma(slots[IndexOf<L, A>::index], slots[IndexOf<L, B>::index],
+                    slots[IndexOf<L, C>::index]);
+  }
+};
+
+
+// walk the nodes still to do front to back, node I of list L goes in slot I
+template <typename Todo, typename L, unsigned int I = 0>
+struct CseSweep;
+
+template <typename L, unsigned int I>
+struct CseSweep<NodeList<>, L, I> {
+  template <typename T, typename Args>
+  static void run(T *slots, const Args &args) {}
+};
+
+template <typename Head, typename... Tail, typename L, unsigned int I>
+struct CseSweep<NodeList<Head, Tail...>, L, I> {
+  template <typename T, typename Args>
+  static void run(T *slots, const Args &args) {
+    slots[I] = CseNode<Head, L>::eval(slots, args);
+    CseSweep<NodeList<Tail...>, L, I + 1>::run(slots, args);
+  }
+};
+
+
+// evaluator for E that computes every unique subexpression once
+template <typename E>
+struct CSE {
+  typedef typename Collect<E, NodeList<>>::Result Nodes;
+
+  enum { size = Nodes::size };
+
+  template <typename Args>
+  static typename ScalarOf<Args>::Type eval(const Args &args) {
+    typedef typename ScalarOf<Args>::Type T;
+    T slots[size];
+    CseSweep<Nodes, Nodes>::run(slots, args);
+    return slots[size - 1];
+  }
+
+  static std::string toString(void) {
+    return E::toString();
+  }
+};
+
+
+// node E computed from the slots of its subexpressions in list L, where slot
+// k is stored as variable VARS_count + k; leaves (constants, variables) are
+// not replaced by slots, so evaluators can still specialize on constants
+
+template <typename E, typename L, bool Leaf = TreeSize<E>::size == 1>
+struct SlotRef {
+  typedef Var<VARS_count + IndexOf<L, E>::index> Result;
+};
+
+template <typename E, typename L>
+struct SlotRef<E, L, true> {
+  typedef E Result;
+};
+
+template <typename E, typename L>
+struct SlotNode {
+  typedef E Result;
+};
+
+template <template <typename> class Op, typename E, typename L>
+struct SlotNode<Op<E>, L> {
+  typedef Op<typename SlotRef<E, L>::Result> Result;
+};
+
+template <template <typename, typename> class Op, typename LHS, typename RHS, typename L>
+struct SlotNode<Op<LHS, RHS>, L> {
+  typedef Op<
+            typename SlotRef<LHS, L>::Result,
+            typename SlotRef<RHS, L>::Result
+          > Result;
+};
+
+template <template <typename, typename, typename> class Op, typename A, typename B, typename C,
+          typename L>
+struct SlotNode<Op<A, B, C>, L> {
+  typedef Op<
+            typename SlotRef<A, L>::Result,
+            typename SlotRef<B, L>::Result,
+            typename SlotRef<C, L>::Result
+          > Result;
+};
+
+
+// several expressions evaluated together
+
+// the unique nodes of all of Es appended to list L
+template <typename L, typename... Es>
+struct CollectAll;
+
+template <typename L>
+struct CollectAll<L> {
+  typedef L Result;
+};
+
+template <typename L, typename E, typename... Es>
+struct CollectAll<L, E, Es...> {
+  typedef typename CollectAll<typename Collect<E, L>::Result, Es...>::Result Result;
+};
+
+// sum of the tree sizes of Es
+template <typename... Es>
+struct TreeSizes {
+  enum { size = 0 };
+};
+
+template <typename E, typename... Es>
+struct TreeSizes<E, Es...> {
+  enum { size = TreeSize<E>::size + TreeSizes<Es...>::size };
+};
+
+// the slots of point i of a tile, slot k of point i is slots[k * EVAL_TILE + i]
+template <typename T>
+struct TileSlots {
+  const T *slots;
+  std::size_t i;
+
+  T operator[](unsigned int k) const {
+    return slots[k * EVAL_TILE + i];
+  }
+};
+
+// walk the nodes still to do front to back for all points of a tile, node I
+// of list L goes in slot I
+template <typename Todo, typename L, unsigned int I = 0>
+struct CseTileSweep;
+
+template <typename L, unsigned int I>
+struct CseTileSweep<NodeList<>, L, I> {
+  template <typename T>
+  static void run(T *slots, const Columns<T> &vars, std::size_t n) {}
+};
+
+template <typename Head, typename... Tail, typename L, unsigned int I>
+struct CseTileSweep<NodeList<Head, Tail...>, L, I> {
+  template <typename T>
+  static void run(T *slots, const Columns<T> &vars, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+      TileSlots<T> point = {slots, i};
+      slots[I * EVAL_TILE + i] = CseNode<Head, L>::eval(point, vars.point(i));
+    }
+    CseTileSweep<NodeList<Tail...>, L, I + 1>::run(slots, vars, n);
+  }
+};
+
+// evaluator for the expressions Es together, typically a function and its
+// derivatives: every subexpression that appears in any of them is computed
+// once per point and shared by all outputs
+template <typename... Es>
+struct Bundle {
+  typedef typename CollectAll<NodeList<>, Es...>::Result Nodes;
+
+  enum {
+    outputs = sizeof...(Es),
+    // node evaluations per point
+    size = Nodes::size,
+    // node evaluations per point when every expression is evaluated on its own
+    separate = TreeSizes<Es...>::size,
+    saved = separate - size
+  };
+
+  // out[k] is set to the value of expression k
+  template <typename Args>
+  static void eval(const Args &args, typename ScalarOf<Args>::Type *out) {
+    typedef typename ScalarOf<Args>::Type T;
+    const unsigned int index[] = {IndexOf<Nodes, Es>::index...};
+
+    T slots[size];
+    CseSweep<Nodes, Nodes>::run(slots, args);
+
+    for (unsigned int k = 0; k < outputs; ++k) {
+      out[k] = slots[index[k]];
+    }
+  }
+
+  // the points are stored as columns like for evalBatch, out[k][i] is set to
+  // the value of expression k at point i; all nodes are evaluated a tile of
+  // points at a time, in slots on the heap since a tile of every node of a
+  // large bundle does not fit on the stack of a thread
+  template <typename T>
+  static void evalBatch(const T *const *vars, std::size_t n, T *const *out) {
+    const unsigned int index[] = {IndexOf<Nodes, Es>::index...};
+    std::unique_ptr<T[]> slots(new T[size * EVAL_TILE]);
+    const T *tile[VARS_count];
+
+    for (std::size_t start = 0; start < n; start += EVAL_TILE) {
+      std::size_t len = n - start < EVAL_TILE ? n - start : EVAL_TILE;
+
+      for (unsigned int id = 0; id < VARS_count; ++id) {
+        tile[id] = vars[id] ? vars[id] + start : nullptr;
+      }
+
+      Columns<T> columns = {tile};
+      CseTileSweep<Nodes, Nodes>::run(slots.get(), columns, len);
+
+      for (unsigned int k = 0; k < outputs; ++k) {
+        const T *result = slots.get() + index[k] * EVAL_TILE;
+        for (std::size_t i = 0; i < len; ++i) {
+          out[k][start + i] = result[i];
+        }
+      }
+    }
+  }
+
+  static std::string toString(void) {
+    const std::string names[] = {Es::toString()...};
+
+    std::string result = "{ ";
+    for (unsigned int k = 0; k < outputs; ++k) {
+      result += (k ? ", " : "") + names[k];
+    }
+    return result + " }";
+  }
+};
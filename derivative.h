@@ -19,8 +19,8 @@ struct Derivative {
 };
 
 // constant derivative
-template <int N, typename D>
-struct Derivative<Const<N>, D> {
+template <int N, int ND, typename D>
+struct Derivative<Const<N, ND>, D> {
   typedef Const<0> Result;
 };
 
@@ -41,6 +41,12 @@ struct Derivative<NumE, D> {
   typedef Const<0> Result;
 };
 
+// number pi derivative
+template <typename D>
+struct Derivative<NumPi, D> {
+  typedef Const<0> Result;
+};
+
 // negation derivative
 // - E -> - E'
 template <typename E, typename D>
@@ -179,3 +185,24 @@ struct Derivative<Exp<LHS, RHS>, D> {
             >
           >::Result Result;
 };
+
+// fused multiply-add derivative
+// fma( A, B, C ) -> A' * B + A * B' + C'
+template <typename A, typename B, typename C, typename D>
+struct Derivative<Fma<A, B, C>, D> {
+  typedef typename Simplify<
+            Add<
+              Add<
+                Mul<
+                  typename Derivative<A, D>::Result,
+                  B
+                >,
+                Mul<
+                  A,
+                  typename Derivative<B, D>::Result
+                >
+              >,
+              typename Derivative<C, D>::Result
+            >
+          >::Result Result;
+};
@@ -5,12 +5,29 @@ are the subexpressions of that expression.
 
 Algebraic operations are done by template specialization.
 
+Evaluation is generic over the scalar type: the arguments decide whether an
+expression is evaluated in float, double or long double, and std::sqrt,
+std::log, std::pow and std::fma pick the overload of that precision.
+
+eval reads variable id of its arguments as args[id], so the arguments can be
+an array or a pointer to the values of all variables, or any accessor object
+that reads them from somewhere else through an operator[] (see access.h).
+
+The text of an expression is put together at compile time as well, as one
+constant array of characters (Text<E>), so toString( ) only copies it and
+writeText( ) and operator<< write it without allocating.
+
 */
 
 #pragma once
 
 #include <string>
 #include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <type_traits>
+#include <utility>
 
 
 // all variables that could be used need to be declared here
@@ -37,9 +54,10 @@ std::string varname(unsigned int id) {
 
 
 // all classes used as expressions are forward declared
-template <int> struct Const;
+template <int, int = 1> struct Const;
 template <unsigned int> struct Var;
 struct NumE;
+struct NumPi;
 
 template <typename> struct Neg;
 template <typename> struct Sqrt;
@@ -51,126 +69,701 @@ template <typename, typename> struct Mul;
 template <typename, typename> struct Div;
 template <typename, typename> struct Exp;
 
+template <typename, typename, typename> struct Fma;
+
+
+// text known at compile time: the characters cs, stored once with a
+// terminating null
+template <char... cs>
+struct Chars {
+  enum { size = sizeof...(cs) };
+  static constexpr char value[sizeof...(cs) + 1] = {cs..., '\0'};
+};
+
+template <char... cs>
+constexpr char Chars<cs...>::value[sizeof...(cs) + 1];
+
+// the Chars of all Parts one after the other
+template <typename... Parts>
+struct Concat;
+
+template <char... cs>
+struct Concat<Chars<cs...>> {
+  typedef Chars<cs...> Result;
+};
+
+template <char... as, char... bs, typename... Parts>
+struct Concat<Chars<as...>, Chars<bs...>, Parts...> {
+  typedef typename Concat<Chars<as..., bs...>, Parts...>::Result Result;
+};
+
+// decimal digits of U followed by Tail
+template <unsigned long long U, typename Tail = Chars<>, bool Last = (U < 10)>
+struct Digits;
+
+template <unsigned long long U, char... cs>
+struct Digits<U, Chars<cs...>, true> {
+  typedef Chars<char('0' + U), cs...> Result;
+};
+
+template <unsigned long long U, char... cs>
+struct Digits<U, Chars<cs...>, false> {
+  typedef typename Digits<U / 10, Chars<char('0' + U % 10), cs...>>::Result Result;
+};
+
+// N as std::to_string writes it
+template <long long N, bool Negative = (N < 0)>
+struct IntChars {
+  typedef typename Digits<N>::Result Result;
+};
+
+template <long long N>
+struct IntChars<N, true> {
+  typedef typename Concat<
+            Chars<'-'>,
+            typename Digits<(unsigned long long) -N>::Result
+          >::Result Result;
+};
+
+// the names of varname( ) at compile time
+template <unsigned int id>
+struct VarChars {
+  typedef Chars<'u', 'n', 'k', 'n', 'o', 'w', 'n'> Result;
+};
+
+template <>
+struct VarChars<VARS_x> {
+  typedef Chars<'x'> Result;
+};
+
+template <>
+struct VarChars<VARS_y> {
+  typedef Chars<'y'> Result;
+};
+
+template <>
+struct VarChars<VARS_z> {
+  typedef Chars<'z'> Result;
+};
+
+
+// the text of expression E as Chars in Result, built at compile time from the
+// texts of its subexpressions, so that E::toString( ) is a single copy
+template <typename E>
+struct Text;
+
+template <int N, int D>
+struct Text<Const<N, D>> {
+  typedef typename std::conditional<
+            D == 1,
+            typename IntChars<N>::Result,
+            typename Concat<
+              Chars<'(', ' '>, typename IntChars<N>::Result,
+              Chars<' ', '/', ' '>, typename IntChars<D>::Result, Chars<' ', ')'>
+            >::Result
+          >::type Result;
+};
+
+template <unsigned int id>
+struct Text<Var<id>> {
+  typedef typename VarChars<id>::Result Result;
+};
+
+template <>
+struct Text<NumE> {
+  typedef Chars<'e'> Result;
+};
+
+template <>
+struct Text<NumPi> {
+  typedef Chars<'p', 'i'> Result;
+};
+
+// Open E )
+template <typename Open, typename E>
+struct UnaryText {
+  typedef typename Concat<Open, typename Text<E>::Result, Chars<' ', ')'>>::Result Result;
+};
+
+template <typename E>
+struct Text<Neg<E>> : UnaryText<Chars<'(', ' ', '-', ' '>, E> {};
+
+template <typename E>
+struct Text<Sqrt<E>> : UnaryText<Chars<'s', 'q', 'r', 't', '(', ' '>, E> {};
+
+template <typename E>
+struct Text<Log<E>> : UnaryText<Chars<'l', 'o', 'g', '(', ' '>, E> {};
+
+// ( LHS op RHS )
+template <typename LHS, char op, typename RHS>
+struct BinaryText {
+  typedef typename Concat<
+            Chars<'(', ' '>, typename Text<LHS>::Result,
+            Chars<' ', op, ' '>, typename Text<RHS>::Result, Chars<' ', ')'>
+          >::Result Result;
+};
+
+template <typename LHS, typename RHS>
+struct Text<Add<LHS, RHS>> : BinaryText<LHS, '+', RHS> {};
+
+template <typename LHS, typename RHS>
+struct Text<Sub<LHS, RHS>> : BinaryText<LHS, '-', RHS> {};
+
+template <typename LHS, typename RHS>
+struct Text<Mul<LHS, RHS>> : BinaryText<LHS, '*', RHS> {};
+
+template <typename LHS, typename RHS>
+struct Text<Div<LHS, RHS>> : BinaryText<LHS, '/', RHS> {};
+
+template <typename LHS, typename RHS>
+struct Text<Exp<LHS, RHS>> : BinaryText<LHS, '^', RHS> {};
+
+template <typename A, typename B, typename C>
+struct Text<Fma<A, B, C>> {
+  typedef typename Concat<
+            Chars<'f', 'm', 'a', '(', ' '>, typename Text<A>::Result,
+            Chars<',', ' '>, typename Text<B>::Result,
+            Chars<',', ' '>, typename Text<C>::Result, Chars<' ', ')'>
+          >::Result Result;
+};
+
+// the text of E as a string, with a single allocation
+template <typename E>
+std::string textString(void) {
+  typedef typename Text<E>::Result Result;
+  return std::string(Result::value, Result::size);
+}
+
+// the text of E written into buffer without allocating, like snprintf: at
+// most size - 1 characters and a terminating null; returns the length of the
+// whole text
+template <typename E>
+std::size_t writeText(char *buffer, std::size_t size) {
+  typedef typename Text<E>::Result Result;
+  if (size > 0) {
+    std::size_t count = Result::size < size ? Result::size : size - 1;
+    std::memcpy(buffer, Result::value, count);
+    buffer[count] = '\0';
+  }
+  return Result::size;
+}
+
+// writes the text of E to a stream without allocating, as in
+//   std::cout << Text<E>() << std::endl;
+template <typename E>
+std::ostream &operator<<(std::ostream &stream, const Text<E> &) {
+  typedef typename Text<E>::Result Result;
+  return stream.write(Result::value, Result::size);
+}
+
+
+// irrational constants, to the precision of long double and rounded to that
+// of the type of the evaluation
+constexpr long double NUM_E = 2.718281828459045235360287471352662498L;
+constexpr long double NUM_PI = 3.141592653589793238462643383279502884L;
+
+
+// the scalar type of the arguments of eval: that of args[id]
+template <typename Args>
+struct ScalarOf {
+  typedef typename std::decay<decltype(std::declval<const Args &>()[0u])>::type Type;
+};
+
+
+// value of an expression together with its derivative in some direction
+template <typename T>
+struct BasicDual {
+  T value;
+  T tangent;
+};
+
+typedef BasicDual<double> Dual;
+
 
-// constant
-template <int N>
+// batched evaluation works on tiles of this many points at a time, small
+// enough for all intermediate results of a tile to stay in cache
+enum { EVAL_TILE = 256 };
+
+// batched evaluation of expression E over n points stored as columns: the
+// value of variable id for point i is vars[id][i] (unused columns can be null)
+// the points are split in tiles that are evaluated node by node
+template <typename E, typename T>
+void evalTiled(const T *const *vars, std::size_t n, T *out) {
+  const T *tile[VARS_count];
+
+  for (std::size_t start = 0; start < n; start += EVAL_TILE) {
+    std::size_t len = n - start;
+    if (len > EVAL_TILE) {
+      len = EVAL_TILE;
+    }
+
+    for (unsigned int id = 0; id < VARS_count; ++id) {
+      tile[id] = vars[id] ? vars[id] + start : nullptr;
+    }
+
+    E::evalTile(tile, len, out + start);
+  }
+}
+
+
+// rational constant N / D, kept with D > 0 and in lowest terms by Simplify
+template <int N, int D>
 struct Const {
-  static double eval(const double *args) {
-    return N;
+  template <typename Args>
+  static typename ScalarOf<Args>::Type eval(const Args &args) {
+    typedef typename ScalarOf<Args>::Type T;
+    return T(N) / D;
   }
 
   static std::string toString(void) {
-    return std::to_string(N);
+    return textString<Const>();
+  }
+
+  template <typename T>
+  static BasicDual<T> evalDual(const T *args, const T *dir) {
+    BasicDual<T> result = {T(N) / D, 0.};
+    return result;
+  }
+
+  template <typename T>
+  static void evalBatch(const T *const *vars, std::size_t n, T *out) {
+    evalTiled<Const>(vars, n, out);
+  }
+
+  template <typename T>
+  static void evalTile(const T *const *vars, std::size_t n, T *out) {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = T(N) / D;
+    }
   }
 };
 
 // variable
 template <unsigned int id>
 struct Var {
-  static double eval(const double *args) {
+  template <typename Args>
+  static typename ScalarOf<Args>::Type eval(const Args &args) {
     return args[id];
   }
 
   static std::string toString(void) {
-    return varname(id);
+    return textString<Var>();
+  }
+
+  template <typename T>
+  static BasicDual<T> evalDual(const T *args, const T *dir) {
+    BasicDual<T> result = {args[id], dir[id]};
+    return result;
+  }
+
+  template <typename T>
+  static void evalBatch(const T *const *vars, std::size_t n, T *out) {
+    evalTiled<Var>(vars, n, out);
+  }
+
+  template <typename T>
+  static void evalTile(const T *const *vars, std::size_t n, T *out) {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = vars[id][i];
+    }
   }
 };
 
 // number e
-struct NumE {};
+struct NumE {
+  template <typename Args>
+  static typename ScalarOf<Args>::Type eval(const Args &args) {
+    typedef typename ScalarOf<Args>::Type T;
+    return T(NUM_E);
+  }
+
+  static std::string toString(void) {
+    return textString<NumE>();
+  }
+
+  template <typename T>
+  static BasicDual<T> evalDual(const T *args, const T *dir) {
+    BasicDual<T> result = {T(NUM_E), 0.};
+    return result;
+  }
+
+  template <typename T>
+  static void evalBatch(const T *const *vars, std::size_t n, T *out) {
+    evalTiled<NumE>(vars, n, out);
+  }
+
+  template <typename T>
+  static void evalTile(const T *const *vars, std::size_t n, T *out) {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = T(NUM_E);
+    }
+  }
+};
+
+// number pi
+struct NumPi {
+  template <typename Args>
+  static typename ScalarOf<Args>::Type eval(const Args &args) {
+    typedef typename ScalarOf<Args>::Type T;
+    return T(NUM_PI);
+  }
+
+  static std::string toString(void) {
+    return textString<NumPi>();
+  }
+
+  template <typename T>
+  static BasicDual<T> evalDual(const T *args, const T *dir) {
+    BasicDual<T> result = {T(NUM_PI), 0.};
+    return result;
+  }
+
+  template <typename T>
+  static void evalBatch(const T *const *vars, std::size_t n, T *out) {
+    evalTiled<NumPi>(vars, n, out);
+  }
+
+  template <typename T>
+  static void evalTile(const T *const *vars, std::size_t n, T *out) {
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = T(NUM_PI);
+    }
+  }
+};
 
 // negation
 template <typename E>
 struct Neg {
-  static double eval(const double *args) {
+  template <typename Args>
+  static typename ScalarOf<Args>::Type eval(const Args &args) {
     return - E::eval(args);
   }
 
   static std::string toString(void) {
-    return "( - " + E::toString() + " )";
+    return textString<Neg>();
+  }
+
+  template <typename T>
+  static BasicDual<T> evalDual(const T *args, const T *dir) {
+    BasicDual<T> e = E::evalDual(args, dir);
+    BasicDual<T> result = {- e.value, - e.tangent};
+    return result;
+  }
+
+  template <typename T>
+  static void evalBatch(const T *const *vars, std::size_t n, T *out) {
+    evalTiled<Neg>(vars, n, out);
+  }
+
+  template <typename T>
+  static void evalTile(const T *const *vars, std::size_t n, T *out) {
+    E::evalTile(vars, n, out);
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = - out[i];
+    }
   }
 };
 
 // square root
 template <typename E>
 struct Sqrt {
-  static double eval(const double *args) {
+  template <typename Args>
+  static typename ScalarOf<Args>::Type eval(const Args &args) {
     return std::sqrt(E::eval(args));
   }
 
   static std::string toString(void) {
-    return "sqrt( " + E::toString() + " )";
+    return textString<Sqrt>();
+  }
+
+  template <typename T>
+  static BasicDual<T> evalDual(const T *args, const T *dir) {
+    BasicDual<T> e = E::evalDual(args, dir);
+    T value = std::sqrt(e.value);
+    BasicDual<T> result = {value, e.tangent / (2 * value)};
+    return result;
+  }
+
+  template <typename T>
+  static void evalBatch(const T *const *vars, std::size_t n, T *out) {
+    evalTiled<Sqrt>(vars, n, out);
+  }
+
+  template <typename T>
+  static void evalTile(const T *const *vars, std::size_t n, T *out) {
+    E::evalTile(vars, n, out);
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = std::sqrt(out[i]);
+    }
   }
 };
 
 // natural logarithm
 template <typename E>
 struct Log {
-  static double eval(const double *args) {
+  template <typename Args>
+  static typename ScalarOf<Args>::Type eval(const Args &args) {
     return std::log(E::eval(args));
   }
 
   static std::string toString(void) {
-    return "log( " + E::toString() + " )";
+    return textString<Log>();
+  }
+
+  template <typename T>
+  static BasicDual<T> evalDual(const T *args, const T *dir) {
+    BasicDual<T> e = E::evalDual(args, dir);
+    BasicDual<T> result = {std::log(e.value), e.tangent / e.value};
+    return result;
+  }
+
+  template <typename T>
+  static void evalBatch(const T *const *vars, std::size_t n, T *out) {
+    evalTiled<Log>(vars, n, out);
+  }
+
+  template <typename T>
+  static void evalTile(const T *const *vars, std::size_t n, T *out) {
+    E::evalTile(vars, n, out);
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = std::log(out[i]);
+    }
   }
 };
 
 // addition
 template <typename LHS, typename RHS>
 struct Add {
-  static double eval(const double *args) {
+  template <typename Args>
+  static typename ScalarOf<Args>::Type eval(const Args &args) {
     return LHS::eval(args) + RHS::eval(args);
   }
 
   static std::string toString(void) {
-    return "( " + LHS::toString() + " + " + RHS::toString() + " )";
+    return textString<Add>();
+  }
+
+  template <typename T>
+  static BasicDual<T> evalDual(const T *args, const T *dir) {
+    BasicDual<T> lhs = LHS::evalDual(args, dir);
+    BasicDual<T> rhs = RHS::evalDual(args, dir);
+    BasicDual<T> result = {lhs.value + rhs.value, lhs.tangent + rhs.tangent};
+    return result;
+  }
+
+  template <typename T>
+  static void evalBatch(const T *const *vars, std::size_t n, T *out) {
+    evalTiled<Add>(vars, n, out);
+  }
+
+  template <typename T>
+  static void evalTile(const T *const *vars, std::size_t n, T *out) {
+    T rhs[EVAL_TILE];
+    LHS::evalTile(vars, n, out);
+    RHS::evalTile(vars, n, rhs);
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = out[i] + rhs[i];
+    }
   }
 };
 
 // subtraction
 template <typename LHS, typename RHS>
 struct Sub {
-  static double eval(const double *args) {
+  template <typename Args>
+  static typename ScalarOf<Args>::Type eval(const Args &args) {
     return LHS::eval(args) - RHS::eval(args);
   }
 
   static std::string toString(void) {
-    return "( " + LHS::toString() + " - " + RHS::toString() + " )";
+    return textString<Sub>();
+  }
+
+  template <typename T>
+  static BasicDual<T> evalDual(const T *args, const T *dir) {
+    BasicDual<T> lhs = LHS::evalDual(args, dir);
+    BasicDual<T> rhs = RHS::evalDual(args, dir);
+    BasicDual<T> result = {lhs.value - rhs.value, lhs.tangent - rhs.tangent};
+    return result;
+  }
+
+  template <typename T>
+  static void evalBatch(const T *const *vars, std::size_t n, T *out) {
+    evalTiled<Sub>(vars, n, out);
+  }
+
+  template <typename T>
+  static void evalTile(const T *const *vars, std::size_t n, T *out) {
+    T rhs[EVAL_TILE];
+    LHS::evalTile(vars, n, out);
+    RHS::evalTile(vars, n, rhs);
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = out[i] - rhs[i];
+    }
   }
 };
 
 // multiplication
 template <typename LHS, typename RHS>
 struct Mul {
-  static double eval(const double *args) {
+  template <typename Args>
+  static typename ScalarOf<Args>::Type eval(const Args &args) {
     return LHS::eval(args) * RHS::eval(args);
   }
 
   static std::string toString(void) {
-    return "( " + LHS::toString() + " * " + RHS::toString() + " )";
+    return textString<Mul>();
+  }
+
+  template <typename T>
+  static BasicDual<T> evalDual(const T *args, const T *dir) {
+    BasicDual<T> lhs = LHS::evalDual(args, dir);
+    BasicDual<T> rhs = RHS::evalDual(args, dir);
+    BasicDual<T> result = {
+      lhs.value * rhs.value,
+      lhs.tangent * rhs.value + lhs.value * rhs.tangent
+    };
+    return result;
+  }
+
+  template <typename T>
+  static void evalBatch(const T *const *vars, std::size_t n, T *out) {
+    evalTiled<Mul>(vars, n, out);
+  }
+
+  template <typename T>
+  static void evalTile(const T *const *vars, std::size_t n, T *out) {
+    T rhs[EVAL_TILE];
+    LHS::evalTile(vars, n, out);
+    RHS::evalTile(vars, n, rhs);
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = out[i] * rhs[i];
+    }
   }
 };
 
 // division
 template <typename LHS, typename RHS>
 struct Div {
-  static double eval(const double *args) {
+  template <typename Args>
+  static typename ScalarOf<Args>::Type eval(const Args &args) {
     return LHS::eval(args) / RHS::eval(args);
   }
 
   static std::string toString(void) {
-    return "( " + LHS::toString() + " / " + RHS::toString() + " )";
+    return textString<Div>();
+  }
+
+  template <typename T>
+  static BasicDual<T> evalDual(const T *args, const T *dir) {
+    BasicDual<T> lhs = LHS::evalDual(args, dir);
+    BasicDual<T> rhs = RHS::evalDual(args, dir);
+    BasicDual<T> result = {
+      lhs.value / rhs.value,
+      (lhs.tangent * rhs.value - lhs.value * rhs.tangent) / (rhs.value * rhs.value)
+    };
+    return result;
+  }
+
+  template <typename T>
+  static void evalBatch(const T *const *vars, std::size_t n, T *out) {
+    evalTiled<Div>(vars, n, out);
+  }
+
+  template <typename T>
+  static void evalTile(const T *const *vars, std::size_t n, T *out) {
+    T rhs[EVAL_TILE];
+    LHS::evalTile(vars, n, out);
+    RHS::evalTile(vars, n, rhs);
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = out[i] / rhs[i];
+    }
   }
 };
 
 // exponent
 template <typename LHS, typename RHS>
 struct Exp {
-  static double eval(const double *args) {
+  template <typename Args>
+  static typename ScalarOf<Args>::Type eval(const Args &args) {
     return std::pow(LHS::eval(args), RHS::eval(args));
   }
 
   static std::string toString(void) {
-    return "( " + LHS::toString() + " ^ " + RHS::toString() + " )";
+    return textString<Exp>();
+  }
+
+  template <typename T>
+  static BasicDual<T> evalDual(const T *args, const T *dir) {
+    BasicDual<T> lhs = LHS::evalDual(args, dir);
+    BasicDual<T> rhs = RHS::evalDual(args, dir);
+    BasicDual<T> result = {std::pow(lhs.value, rhs.value), 0.};
+
+    // terms with a zero tangent are skipped, like Simplify drops them from
+    // the symbolic derivative
+    if (lhs.tangent != 0) {
+      result.tangent += rhs.value * std::pow(lhs.value, rhs.value - 1) * lhs.tangent;
+    }
+    if (rhs.tangent != 0) {
+      result.tangent += result.value * std::log(lhs.value) * rhs.tangent;
+    }
+    return result;
+  }
+
+  template <typename T>
+  static void evalBatch(const T *const *vars, std::size_t n, T *out) {
+    evalTiled<Exp>(vars, n, out);
+  }
+
+  template <typename T>
+  static void evalTile(const T *const *vars, std::size_t n, T *out) {
+    T rhs[EVAL_TILE];
+    LHS::evalTile(vars, n, out);
+    RHS::evalTile(vars, n, rhs);
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = std::pow(out[i], rhs[i]);
+    }
+  }
+};
+
+// fused multiply-add A * B + C, rounded once (see Lower<> in lower.h)
+template <typename A, typename B, typename C>
+struct Fma {
+  template <typename Args>
+  static typename ScalarOf<Args>::Type eval(const Args &args) {
+    return std::fma(A::eval(args), B::eval(args), C::eval(args));
+  }
+
+  static std::string toString(void) {
+    return textString<Fma>();
+  }
+
+  template <typename T>
+  static BasicDual<T> evalDual(const T *args, const T *dir) {
+    BasicDual<T> a = A::evalDual(args, dir);
+    BasicDual<T> b = B::evalDual(args, dir);
+    BasicDual<T> c = C::evalDual(args, dir);
+    BasicDual<T> result = {
+      std::fma(a.value, b.value, c.value),
+      a.tangent * b.value + a.value * b.tangent + c.tangent
+    };
+    return result;
+  }
+
+  template <typename T>
+  static void evalBatch(const T *const *vars, std::size_t n, T *out) {
+    evalTiled<Fma>(vars, n, out);
+  }
+
+  template <typename T>
+  static void evalTile(const T *const *vars, std::size_t n, T *out) {
+    T b[EVAL_TILE];
+    T c[EVAL_TILE];
+    A::evalTile(vars, n, out);
+    B::evalTile(vars, n, b);
+    C::evalTile(vars, n, c);
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = std::fma(out[i], b[i], c[i]);
+    }
   }
 };
@@ -0,0 +1,48 @@
+// Writes the kernels of the benchmark as plain C++ (see codegen.h) into a
+// header, as a build step of the benchmark
+//
+// Usage: generate <header>
+
+#include "expression.h"
+#include "simplify.h"
+#include "derivative.h"
+#include "polynomial.h"
+#include "lower.h"
+#include "codegen.h"
+#include "benchmark.h"
+
+#include <fstream>
+#include <iostream>
+
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    std::cerr << "usage: generate <header>" << std::endl;
+    return 1;
+  }
+
+  typedef Simplify<Expr3>::Result Expr3Simp;
+  typedef Derivative<Expr4, Var<VARS_z>>::Result Expr4Der;
+  typedef Simplify<Monomials<24>::Result>::Result MonoSimp;
+  typedef Derivative<MonoSimp, Var<VARS_x>>::Result MonoDer;
+  typedef Derivative<Simplify<Factors<8>::Result>::Result, Var<VARS_x>>::Result FactDer;
+
+  // lowered first, so integer powers are written as multiplications instead of
+  // std::pow
+  std::string sources =
+    "namespace generated {\n\n" +
+    CodeGen<Lower<Polynomials<Expr3Simp>::Result>::Result>::source("expr3Horner") + "\n" +
+    CodeGen<Lower<Expr4Der>::Result>::source("expr4Der") + "\n" +
+    CodeGen<Lower<MonoSimp>::Result>::source("monoSimp") + "\n" +
+    CodeGen<Lower<MonoDer>::Result>::source("monoDer") + "\n" +
+    CodeGen<Lower<FactDer>::Result>::source("factDer") + "\n" +
+    "}\n";
+
+  std::ofstream out(argv[1]);
+  out << generatedHeader(sources);
+  if (!out) {
+    std::cerr << "cannot write " << argv[1] << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,191 @@
+/* Reverse mode derivatives
+
+The gradient of an expression with respect to all variables is computed in
+two sweeps over the unique nodes of the expression (see cse.h). The forward
+sweep evaluates every node into its slot. The backward sweep goes through the
+nodes in reverse order and passes the adjoint of every node (the derivative of
+the whole expression with respect to that node) on to its subexpressions. The
+adjoints of the variables are the gradient.
+
+Both sweeps work in two arrays on the stack with one entry per unique node, so
+the cost is a small multiple of a single evaluation, whatever the number of
+variables.
+*/
+
+#pragma once
+
+#include "expression.h"
+#include "cse.h"
+
+
+// passing on the adjoint adj[I] of node E (node I in list L) to its
+// subexpressions; every node needs its own specialization, a node without one
+// does not compile instead of getting no adjoint
+template <typename E, typename L, unsigned int I>
+struct Adjoint;
+
+// constants have no subexpressions
+template <int N, int ND, typename L, unsigned int I>
+struct Adjoint<Const<N, ND>, L, I> {
+  static void run(const double *slots, double *adj, double *grad) {}
+};
+
+template <typename L, unsigned int I>
+struct Adjoint<NumE, L, I> {
+  static void run(const double *slots, double *adj, double *grad) {}
+};
+
+template <typename L, unsigned int I>
+struct Adjoint<NumPi, L, I> {
+  static void run(const double *slots, double *adj, double *grad) {}
+};
+
+// the adjoint of a variable is its entry in the gradient
+template <unsigned int id, typename L, unsigned int I>
+struct Adjoint<Var<id>, L, I> {
+  static void run(const double *slots, double *adj, double *grad) {
+    grad[id] += adj[I];
+  }
+};
+
+// - A -> A: - adj
+template <typename E, typename L, unsigned int I>
+struct Adjoint<Neg<E>, L, I> {
+  static void run(const double *slots, double *adj, double *grad) {
+    adj[IndexOf<L, E>::index] -= adj[I];
+  }
+};
+
+// sqrt( A ) -> A: adj / (2 * sqrt( A ))
+template <typename E, typename L, unsigned int I>
+struct Adjoint<Sqrt<E>, L, I> {
+  static void run(const double *slots, double *adj, double *grad) {
+    adj[IndexOf<L, E>::index] += adj[I] / (2 * slots[I]);
+  }
+};
+
+// log( A ) -> A: adj / A
+template <typename E, typename L, unsigned int I>
+struct Adjoint<Log<E>, L, I> {
+  static void run(const double *slots, double *adj, double *grad) {
+    adj[IndexOf<L, E>::index] += adj[I] / slots[IndexOf<L, E>::index];
+  }
+};
+
+// A + B -> A: adj, B: adj
+template <typename LHS, typename RHS, typename L, unsigned int I>
+struct Adjoint<Add<LHS, RHS>, L, I> {
+  static void run(const double *slots, double *adj, double *grad) {
+    adj[IndexOf<L, LHS>::index] += adj[I];
+    adj[IndexOf<L, RHS>::index] += adj[I];
+  }
+};
+
+// A - B -> A: adj, B: - adj
+template <typename LHS, typename RHS, typename L, unsigned int I>
+struct Adjoint<Sub<LHS, RHS>, L, I> {
+  static void run(const double *slots, double *adj, double *grad) {
+    adj[IndexOf<L, LHS>::index] += adj[I];
+    adj[IndexOf<L, RHS>::index] -= adj[I];
+  }
+};
+
+// A * B -> A: adj * B, B: adj * A
+template <typename LHS, typename RHS, typename L, unsigned int I>
+struct Adjoint<Mul<LHS, RHS>, L, I> {
+  static void run(const double *slots, double *adj, double *grad) {
+    adj[IndexOf<L, LHS>::index] += adj[I] * slots[IndexOf<L, RHS>::index];
+    adj[IndexOf<L, RHS>::index] += adj[I] * slots[IndexOf<L, LHS>::index];
+  }
+};
+
+// A / B -> A: adj / B, B: - adj * (A / B) / B
+template <typename LHS, typename RHS, typename L, unsigned int I>
+struct Adjoint<Div<LHS, RHS>, L, I> {
+  static void run(const double *slots, double *adj, double *grad) {
+    adj[IndexOf<L, LHS>::index] += adj[I] / slots[IndexOf<L, RHS>::index];
+    adj[IndexOf<L, RHS>::index] -= adj[I] * slots[I] / slots[IndexOf<L, RHS>::index];
+  }
+};
+
+// A ^ B -> A: adj * B * A ^ (B - 1), B: adj * A ^ B * log( A )
+template <typename LHS, typename RHS, typename L, unsigned int I>
+struct Adjoint<Exp<LHS, RHS>, L, I> {
+  static void run(const double *slots, double *adj, double *grad) {
+    double base = slots[IndexOf<L, LHS>::index];
+    double power = slots[IndexOf<L, RHS>::index];
+    adj[IndexOf<L, LHS>::index] += adj[I] * power * std::pow(base, power - 1);
+    adj[IndexOf<L, RHS>::index] += adj[I] * slots[I] * std::log(base);
+  }
+};
+
+// A ^ N -> A: adj * N * A ^ (N - 1)
+// the constant exponent needs no adjoint, which also avoids log( A ) for A <= 0
+template <typename E, int N, int ND, typename L, unsigned int I>
+struct Adjoint<Exp<E, Const<N, ND>>, L, I> {
+  static void run(const double *slots, double *adj, double *grad) {
+    double power = double(N) / ND;
+    adj[IndexOf<L, E>::index] += adj[I] * power * std::pow(slots[IndexOf<L, E>::index], power - 1);
+  }
+};
+
+// fma( A, B, C ) -> A: adj * B, B: adj * A, C: adj
+template <typename A, typename B, typename C, typename L, unsigned int I>
+struct Adjoint<Fma<A, B, C>, L, I> {
+  static void run(const double *slots, double *adj, double *grad) {
+    adj[IndexOf<L, A>::index] += adj[I] * slots[IndexOf<L, B>::index];
+    adj[IndexOf<L, B>::index] += adj[I] * slots[IndexOf<L, A>::index];
+    adj[IndexOf<L, C>::index] += adj[I];
+  }
+};
+
+
+// forward sweep on the way down the node list and backward sweep on the way up
+template <typename Todo, typename L, unsigned int I = 0>
+struct GradientSweep;
+
+template <typename L, unsigned int I>
+struct GradientSweep<NodeList<>, L, I> {
+  static void run(double *slots, double *adj, const double *args, double *grad) {}
+};
+
+template <typename Head, typename... Tail, typename L, unsigned int I>
+struct GradientSweep<NodeList<Head, Tail...>, L, I> {
+  static void run(double *slots, double *adj, const double *args, double *grad) {
+    slots[I] = CseNode<Head, L>::eval(slots, args);
+    GradientSweep<NodeList<Tail...>, L, I + 1>::run(slots, adj, args, grad);
+    Adjoint<Head, L, I>::run(slots, adj, grad);
+  }
+};
+
+
+// value and gradient of E with respect to all VARS_count variables
+template <typename E>
+struct Gradient {
+  typedef typename CSE<E>::Nodes Nodes;
+
+  enum { size = Nodes::size };
+
+  // returns the value of E and writes the derivative with respect to variable
+  // id in grad[id]
+  static double eval(const double *args, double *grad) {
+    double slots[size];
+    double adj[size];
+
+    for (unsigned int i = 0; i < size; ++i) {
+      adj[i] = 0;
+    }
+    adj[size - 1] = 1;
+
+    for (unsigned int id = 0; id < VARS_count; ++id) {
+      grad[id] = 0;
+    }
+
+    GradientSweep<Nodes, Nodes>::run(slots, adj, args, grad);
+    return slots[size - 1];
+  }
+
+  static std::string toString(void) {
+    return E::toString();
+  }
+};
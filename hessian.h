@@ -0,0 +1,151 @@
+/* Second derivatives
+
+The Hessian of an expression is symmetric, so only the second derivatives
+d/dVar<J> d/dVar<I> E with I <= J are taken. Each of them is the derivative of
+the (simplified) first derivative d/dVar<I> E, which is shared by a whole row.
+All second derivatives are then collected into one list of unique nodes (see
+cse.h), such that terms that appear in several entries of the matrix are
+computed only once.
+*/
+
+#pragma once
+
+#include "expression.h"
+#include "derivative.h"
+#include "cse.h"
+
+
+// second derivative of E, first with respect to Var<I> and then to Var<J>
+template <typename E, unsigned int I, unsigned int J>
+struct SecondDerivative {
+  typedef typename Derivative<
+            typename Derivative<E, Var<I>>::Result,
+            Var<J>
+          >::Result Result;
+};
+
+
+// collect the first derivatives of E with respect to Var<I> and up into list L
+template <typename E, unsigned int I, typename L>
+struct GradientCollect {
+  typedef typename GradientCollect<
+            E,
+            I + 1,
+            typename Collect<
+              typename Derivative<E, Var<I>>::Result,
+              L
+            >::Result
+          >::Result Result;
+};
+
+template <typename E, typename L>
+struct GradientCollect<E, VARS_count, L> {
+  typedef L Result;
+};
+
+// collect the second derivatives of E from entry (I, J) of the upper triangle
+// onwards into list L, row by row
+template <typename E, unsigned int I, unsigned int J, typename L>
+struct HessianCollect {
+  typedef typename HessianCollect<
+            E,
+            I,
+            J + 1,
+            typename Collect<
+              typename SecondDerivative<E, I, J>::Result,
+              L
+            >::Result
+          >::Result Result;
+};
+
+template <typename E, unsigned int I, typename L>
+struct HessianCollect<E, I, VARS_count, L> {
+  typedef typename HessianCollect<E, I + 1, I + 1, L>::Result Result;
+};
+
+template <typename E, typename L>
+struct HessianCollect<E, VARS_count, VARS_count, L> {
+  typedef L Result;
+};
+
+
+// copy the first derivatives from Var<I> on out of the slots of list L
+template <typename E, typename L, unsigned int I = 0>
+struct GradientStore {
+  static void run(const double *slots, double *grad) {
+    grad[I] = slots[IndexOf<L, typename Derivative<E, Var<I>>::Result>::index];
+    GradientStore<E, L, I + 1>::run(slots, grad);
+  }
+};
+
+template <typename E, typename L>
+struct GradientStore<E, L, VARS_count> {
+  static void run(const double *slots, double *grad) {}
+};
+
+// copy the second derivatives from entry (I, J) on out of the slots of list L,
+// into both halves of the row-major matrix
+template <typename E, typename L, unsigned int I = 0, unsigned int J = 0>
+struct HessianStore {
+  static void run(const double *slots, double *hessian) {
+    double value = slots[IndexOf<L, typename SecondDerivative<E, I, J>::Result>::index];
+    hessian[I * VARS_count + J] = value;
+    hessian[J * VARS_count + I] = value;
+    HessianStore<E, L, I, J + 1>::run(slots, hessian);
+  }
+};
+
+template <typename E, typename L, unsigned int I>
+struct HessianStore<E, L, I, VARS_count> {
+  static void run(const double *slots, double *hessian) {
+    HessianStore<E, L, I + 1, I + 1>::run(slots, hessian);
+  }
+};
+
+template <typename E, typename L>
+struct HessianStore<E, L, VARS_count, VARS_count> {
+  static void run(const double *slots, double *hessian) {}
+};
+
+
+// Hessian of E with respect to all VARS_count variables
+template <typename E>
+struct Hessian {
+  // the unique nodes of all second derivatives
+  typedef typename HessianCollect<E, 0, 0, NodeList<>>::Result Nodes;
+
+  // the unique nodes of the value, the first and the second derivatives
+  typedef typename HessianCollect<
+            E,
+            0,
+            0,
+            typename GradientCollect<
+              E,
+              0,
+              typename Collect<E, NodeList<>>::Result
+            >::Result
+          >::Result AllNodes;
+
+  enum { size = Nodes::size };
+
+  // writes the second derivative with respect to variables i and j into
+  // hessian[i * VARS_count + j], a buffer of VARS_count * VARS_count doubles
+  static void eval(const double *args, double *hessian) {
+    double slots[size];
+    CseSweep<Nodes, Nodes>::run(slots, args);
+    HessianStore<E, Nodes>::run(slots, hessian);
+  }
+
+  // also computes the gradient into grad and returns the value of E
+  static double eval(const double *args, double *grad, double *hessian) {
+    double slots[AllNodes::size];
+    CseSweep<AllNodes, AllNodes>::run(slots, args);
+    GradientStore<E, AllNodes>::run(slots, grad);
+    HessianStore<E, AllNodes>::run(slots, hessian);
+    return slots[IndexOf<AllNodes, E>::index];
+  }
+
+  static std::string toString(void) {
+    return E::toString();
+  }
+};
@@ -0,0 +1,224 @@
+/* Strength reduction
+
+Lowering rewrites a (simplified) expression into one that is cheaper to
+evaluate but not necessarily easier to read or to simplify further, so it is
+meant as the last step before evaluation:
+
+  E ^ N         -> multiplications by repeated squaring
+  E ^ (-N)      -> 1 / (multiplications by repeated squaring)
+  E ^ (P / 2)   -> sqrt( E ) times multiplications by repeated squaring
+  E / N         -> (1 / N) * E, as Simplify<> does
+  A * B + C     -> fma( A, B, C ), rounded once instead of twice
+  A * B - C     -> fma( A, B, - C )
+  C - A * B     -> fma( - A, B, C )
+
+The squaring produces products of identical subexpressions, like (E * E) *
+(E * E) for E ^ 4, so the lowered expression should be evaluated with CSE<> to
+compute each of them once. The results can differ from those of std::pow and
+from a true division by an ulp or so.
+
+Fused multiply-adds are more accurate and faster, but only where the hardware
+has an instruction for them; elsewhere std::fma is a slow library call. So
+Lower<E> fuses by default only when the compiler targets such hardware
+(__FMA__, with -march=native on most machines since 2013). The policy can be
+given explicitly: Lower<E, Fused> always fuses, Lower<E, Unfused> never does,
+for results that are bit-identical to those of the unfused expression.
+*/
+
+#pragma once
+
+#include "expression.h"
+#include "simplify.h"
+
+
+// policies for fusing multiplications and additions
+struct Fused {};
+struct Unfused {};
+
+#if defined(__FMA__) || defined(__FMA4__)
+typedef Fused DefaultFma;
+#else
+typedef Unfused DefaultFma;
+#endif
+
+
+// E ^ N for N >= 1 as multiplications, by repeated squaring of E ^ (N / 2)
+template <typename Half, typename E, int Odd>
+struct PowSquare {
+  typedef Mul<Half, Half> Result;
+};
+
+template <typename Half, typename E>
+struct PowSquare<Half, E, 1> {
+  typedef Mul<Mul<Half, Half>, E> Result;
+};
+
+template <typename E, int N>
+struct PowChain {
+  typedef typename PowSquare<
+            typename PowChain<E, N / 2>::Result,
+            E,
+            N % 2
+          >::Result Result;
+};
+
+template <typename E>
+struct PowChain<E, 1> {
+  typedef E Result;
+};
+
+// E ^ N for any integer N
+template <typename E, int N, bool Negative = (N < 0)>
+struct IntegerPow {
+  typedef typename PowChain<E, N>::Result Result;
+};
+
+template <typename E, int N>
+struct IntegerPow<E, N, true> {
+  typedef Div<
+            Const<1>,
+            typename PowChain<E, -N>::Result
+          > Result;
+};
+
+template <typename E>
+struct IntegerPow<E, 0, false> {
+  typedef Const<1> Result;
+};
+
+// E ^ (P / 2): for odd P sqrt( E ) * E ^ ((P - 1) / 2), for even P E ^ (P / 2)
+template <typename E, int P, bool Odd = (P % 2 != 0), bool Negative = (P < 0)>
+struct HalfPow {
+  typedef typename IntegerPow<E, P / 2>::Result Result;
+};
+
+template <typename E, int P>
+struct HalfPow<E, P, true, false> {
+  typedef Mul<
+            Sqrt<E>,
+            typename PowChain<E, (P - 1) / 2>::Result
+          > Result;
+};
+
+template <typename E>
+struct HalfPow<E, 1, true, false> {
+  typedef Sqrt<E> Result;
+};
+
+template <typename E, int P>
+struct HalfPow<E, P, true, true> {
+  typedef Div<
+            Const<1>,
+            typename HalfPow<E, -P>::Result
+          > Result;
+};
+
+
+// A + B and A - B with lowered A and B, fused when one of them is a product
+template <typename LHS, typename RHS>
+struct FuseAdd {
+  typedef Add<LHS, RHS> Result;
+};
+
+template <typename A, typename B, typename C>
+struct FuseAdd<Mul<A, B>, C> {
+  typedef Fma<A, B, C> Result;
+};
+
+template <typename A, typename B, typename C>
+struct FuseAdd<C, Mul<A, B>> {
+  typedef Fma<A, B, C> Result;
+};
+
+template <typename A, typename B, typename C, typename D>
+struct FuseAdd<Mul<A, B>, Mul<C, D>> {
+  typedef Fma<A, B, Mul<C, D>> Result;
+};
+
+template <typename LHS, typename RHS>
+struct FuseSub {
+  typedef Sub<LHS, RHS> Result;
+};
+
+template <typename A, typename B, typename C>
+struct FuseSub<Mul<A, B>, C> {
+  typedef Fma<A, B, Neg<C>> Result;
+};
+
+template <typename A, typename B, typename C>
+struct FuseSub<C, Mul<A, B>> {
+  typedef Fma<Neg<A>, B, C> Result;
+};
+
+template <typename A, typename B, typename C, typename D>
+struct FuseSub<Mul<A, B>, Mul<C, D>> {
+  typedef Fma<A, B, Neg<Mul<C, D>>> Result;
+};
+
+
+// by default there is nothing to lower
+template <typename E, typename Policy = DefaultFma>
+struct Lower {
+  typedef E Result;
+};
+
+// expressions containing subexpressions pass the lowering on
+template <template <typename> class Op, typename E, typename Policy>
+struct Lower<Op<E>, Policy> {
+  typedef Op<typename Lower<E, Policy>::Result> Result;
+};
+
+template <template <typename, typename> class Op, typename LHS, typename RHS, typename Policy>
+struct Lower<Op<LHS, RHS>, Policy> {
+  typedef Op<
+            typename Lower<LHS, Policy>::Result,
+            typename Lower<RHS, Policy>::Result
+          > Result;
+};
+
+
+// here the lowering rules start
+
+// E ^ N -> E * E * ... * E
+template <typename E, int N, typename Policy>
+struct Lower<Exp<E, Const<N>>, Policy> {
+  typedef typename IntegerPow<
+            typename Lower<E, Policy>::Result,
+            N
+          >::Result Result;
+};
+
+// E ^ (P / 2) -> sqrt( E ) * E * ... * E
+template <typename E, int P, typename Policy>
+struct Lower<Exp<E, Const<P, 2>>, Policy> {
+  typedef typename HalfPow<
+            typename Lower<E, Policy>::Result,
+            P
+          >::Result Result;
+};
+
+// E / N -> (1 / N) * E, but E / 0 stays a division
+template <typename E, int N, int ND, typename Policy>
+struct Lower<Div<E, Const<N, ND>>, Policy> {
+  typedef typename Lower<E, Policy>::Result Lowered;
+  typedef typename Rational<ND, N>::Result C;
+  typedef typename Folded<C, Mul<C, Lowered>, Div<Lowered, Const<N, ND>>>::Result Result;
+};
+
+// A * B + C -> fma( A, B, C ), also for products that only appear by lowering
+template <typename LHS, typename RHS>
+struct Lower<Add<LHS, RHS>, Fused> {
+  typedef typename FuseAdd<
+            typename Lower<LHS, Fused>::Result,
+            typename Lower<RHS, Fused>::Result
+          >::Result Result;
+};
+
+// A * B - C -> fma( A, B, - C ) and C - A * B -> fma( - A, B, C )
+template <typename LHS, typename RHS>
+struct Lower<Sub<LHS, RHS>, Fused> {
+  typedef typename FuseSub<
+            typename Lower<LHS, Fused>::Result,
+            typename Lower<RHS, Fused>::Result
+          >::Result Result;
+};
@@ -3,8 +3,20 @@
 #include "expression.h"
 #include "simplify.h"
 #include "derivative.h"
+#include "cse.h"
+#include "gradient.h"
+#include "simd.h"
+#include "lower.h"
+#include "bytecode.h"
+#include "runtime.h"
+#include "polynomial.h"
+#include "access.h"
+#include "taylor.h"
+#include "newton.h"
+#include "optimize.h"
 
 #include <iostream>
+#include <cmath>
 
 
 // A little helper class to not forget to free the memory where
@@ -20,6 +32,36 @@ struct DeferDelete {
 };
 
 
+// Points kept in structs with more fields than the variables
+struct Particle {
+  int id;
+  double x, y, z;
+  double mass;
+};
+
+
+// The largest relative difference between evaluating E in float and in
+// double over the points stored in columns. Both start from the same float
+// inputs, so only the evaluation itself is compared.
+template <typename E>
+double floatError(const double *const *columns, unsigned int count) {
+  double maxError = 0.;
+  for (unsigned int i = 0; i < count; ++i) {
+    float pointFloat[VARS_count];
+    double point[VARS_count];
+    for (unsigned int id = 0; id < VARS_count; ++id) {
+      pointFloat[id] = (float) columns[id][i];
+      point[id] = pointFloat[id];
+    }
+
+    double exact = E::eval(point);
+    double error = std::fabs(E::eval(pointFloat) - exact) / std::fabs(exact);
+    maxError = error > maxError ? error : maxError;
+  }
+  return maxError;
+}
+
+
 int main(void) {
 
   // Reserve some memory where the put the variable values
@@ -122,8 +164,281 @@ int main(void) {
   std::cout << "Input:      " << Expr3::toString() << std::endl;
   std::cout << "Simplified: " << Expr3Simp::toString() << std::endl;
   std::cout << "Evaluated:  " << Expr3Simp::eval(args) << std::endl;
-  std::cout << "Derivative: " << Expr3Der::toString() << std::endl;
+  // the text is known at compile time and streamed without a std::string
+  std::cout << "Derivative: " << Text<Expr3Der>() << std::endl;
   std::cout << "Evaluated:  " << Expr3Der::eval(args) << std::endl;
+
+  // The value and the derivative can also be computed in a single pass over
+  // the expression, here in the direction of x
+  double dirX[VARS_count] = {1., 0., 0.};
+  Dual dual = Expr3Simp::evalDual(args, dirX);
+  std::cout << "Dual:       " << dual.value << ", " << dual.tangent << std::endl;
+  std::cout << "---" << std::endl;
+
+
+  // Derivatives tend to repeat subexpressions: d/dz (x + y)^z contains x + y
+  // twice. The CSE evaluator computes every unique subexpression only once.
+  typedef Exp<
+            Add<
+              Var<VARS_x>,
+              Var<VARS_y>
+            >,
+            Var<VARS_z>
+          > Expr4;
+
+  // Take the derivative wrt z
+  typedef typename Derivative<Expr4, Var<VARS_z>>::Result Expr4Der;
+
+  // Check the outcome
+  std::cout << "Input:      " << Expr4::toString() << std::endl;
+  std::cout << "Derivative: " << Expr4Der::toString() << std::endl;
+  std::cout << "Nodes:      " << CSE<Expr4Der>::size << " unique" << std::endl;
+  std::cout << "Evaluated:  " << CSE<Expr4Der>::eval(args) << std::endl;
+
+  // The derivatives with respect to all variables at once, in reverse mode
+  double grad[VARS_count];
+  Gradient<Expr4>::eval(args, grad);
+  std::cout << "Gradient:   " << grad[VARS_x] << ", " << grad[VARS_y] << ", " << grad[VARS_z] << std::endl;
+
+  // The function and its partial derivatives can also be evaluated together,
+  // such that every subexpression they share is computed once for all of them
+  typedef Bundle<
+            Expr4,
+            typename Derivative<Expr4, Var<VARS_x>>::Result,
+            typename Derivative<Expr4, Var<VARS_y>>::Result,
+            Expr4Der
+          > Expr4All;
+
+  double values[Expr4All::outputs];
+  Expr4All::eval(args, values);
+  std::cout << "Bundle:     " << values[0] << ", " << values[1] << ", " << values[2] << ", "
+            << values[3] << std::endl;
+  std::cout << "Nodes:      " << Expr4All::size << " instead of " << Expr4All::separate << ", "
+            << Expr4All::saved << " saved" << std::endl;
+  std::cout << "---" << std::endl;
+
+
+  // Many points can be evaluated at once when the values of every variable
+  // are stored in their own column, here the polynomial for x = 0, 1, 2, 3
+  const unsigned int count = 4;
+  double xs[count] = {0., 1., 2., 3.};
+  double results[count];
+  const double *columns[VARS_count] = {xs, nullptr, nullptr};
+
+  Expr3Simp::evalBatch(columns, count, results);
+
+  std::cout << "Batch:      ";
+  for (unsigned int i = 0; i < count; ++i) {
+    std::cout << results[i] << " ";
+  }
+  std::cout << std::endl;
+
+  // Points stored in any other layout are read where they are through an
+  // accessor, here from an array of structs
+  Particle particles[count] = {{0, 0., 1., 1., 1.}, {1, 1., 1., 2., 1.},
+                               {2, 2., 1., 3., 1.}, {3, 3., 1., 4., 1.}};
+  Fields<Particle> fields = {particles, {&Particle::x, &Particle::y, &Particle::z}};
+
+  AccessEval<Expr3Simp>::evalBatch(fields, count, results);
+
+  std::cout << "Fields:     ";
+  for (unsigned int i = 0; i < count; ++i) {
+    std::cout << results[i] << " ";
+  }
+  std::cout << std::endl;
+  std::cout << "Point:      " << Expr4Der::eval(fields.point(2)) << std::endl;
+  std::cout << "---" << std::endl;
+
+
+  // The polynomial is cheaper to evaluate with Horner's scheme on its
+  // coefficients than as a sum of powers, and so is its derivative
+  typedef typename Polynomials<Expr3Simp>::Result Expr3Poly;
+  typedef typename Derivative<Expr3Poly, Var<VARS_x>>::Result Expr3PolyDer;
+
+  std::cout << "Polynomial: " << Expr3Poly::toString() << std::endl;
+  std::cout << "Evaluated:  " << Expr3Poly::eval(args) << std::endl;
+  std::cout << "Derivative: " << Expr3PolyDer::toString() << std::endl;
+  std::cout << "Evaluated:  " << Expr3PolyDer::eval(args) << std::endl;
+
+  // Lowering fuses the multiplications and additions into fma( ), which
+  // rounds once instead of twice
+  typedef typename Lower<Expr3Der, Fused>::Result Expr3DerFused;
+
+  std::cout << "Fused:      " << Expr3DerFused::toString() << std::endl;
+  std::cout << "Evaluated:  " << Expr3DerFused::eval(args) << std::endl;
+  std::cout << "---" << std::endl;
+
+
+  // Constants are fractions, so the division by 3 and the 1 / 2 in the
+  // derivative of the square root are computed at compile time:
+  // d/dx sqrt(x^2 + y) / 3
+  typedef Div<
+            Sqrt<
+              Add<
+                Exp<Var<VARS_x>, Const<2>>,
+                Var<VARS_y>
+              >
+            >,
+            Const<3>
+          > Expr5;
+
+  typedef typename Simplify<Expr5>::Result Expr5Simp;
+  typedef typename Derivative<Expr5Simp, Var<VARS_x>>::Result Expr5Der;
+
+  std::cout << "Input:      " << Expr5::toString() << std::endl;
+  std::cout << "Simplified: " << Expr5Simp::toString() << std::endl;
+  std::cout << "Derivative: " << Expr5Der::toString() << std::endl;
+  std::cout << "Evaluated:  " << Expr5Der::eval(args) << std::endl;
+
+  // Its Taylor expansion in x up to order 4 costs one evaluation of all the
+  // coefficients, after which nearby values of x only cost a polynomial
+  typedef Taylor<Expr5, Var<VARS_x>, 4> Expr5Taylor;
+
+  double coeffs[Expr5Taylor::size];
+  Expr5Taylor::eval(args, coeffs);
+
+  double nearby[VARS_count] = {args[VARS_x] + 0.1, args[VARS_y], args[VARS_z]};
+  std::cout << "Taylor:     " << coeffs[0] << ", " << coeffs[1] << ", " << coeffs[2] << ", "
+            << coeffs[3] << ", " << coeffs[4] << std::endl;
+  std::cout << "Nodes:      " << Expr5Taylor::Coefficients::size << " instead of "
+            << Expr5Taylor::Coefficients::separate << std::endl;
+  std::cout << "Near x:     " << Expr5Taylor::approximate(coeffs, 0.1) << " for "
+            << Expr5Simp::eval(nearby) << std::endl;
+  std::cout << "---" << std::endl;
+
+
+  // The SIMD evaluation uses its own logarithm and exponential, so compare it
+  // with the scalar evaluation on some more points. Every lane should stay
+  // within the bounds of simd.h: (1 + |z log(x + y)|) ulp for the power, 1 ulp
+  // for the logarithm, and 1 ulp for the product and the rounding of the
+  // scalar evaluation itself
+  const unsigned int points = 1000;
+  double columnX[points], columnY[points], columnZ[points];
+  double simd[points];
+  const double *columnsXYZ[VARS_count] = {columnX, columnY, columnZ};
+  for (unsigned int i = 0; i < points; ++i) {
+    columnX[i] = 0.5 + 0.003 * i;
+    columnY[i] = 2.5 - 0.002 * i;
+    columnZ[i] = 0.1 + 0.004 * i;
+  }
+
+  SimdEval<Expr4Der>::evalBatch(columnsXYZ, points, simd);
+
+  unsigned long long maxUlp = 0;
+  unsigned int beyond = 0;
+  for (unsigned int i = 0; i < points; ++i) {
+    double point[VARS_count] = {columnX[i], columnY[i], columnZ[i]};
+    unsigned long long ulp = ulpDistance(simd[i], Expr4Der::eval(point));
+    maxUlp = ulp > maxUlp ? ulp : maxUlp;
+
+    double bound = 3. + std::fabs(columnZ[i] * std::log(columnX[i] + columnY[i]));
+    if (ulp > bound) {
+      std::cout << "SIMD error: " << ulp << " ulp at " << columnX[i] << ", " << columnY[i]
+                << ", " << columnZ[i] << ", beyond " << bound << " ulp" << std::endl;
+      ++beyond;
+    }
+  }
+
+  std::cout << "SIMD:       " << SIMD_WIDTH << " lanes, " << Expr4Der::toString() << std::endl;
+  std::cout << "Difference: " << maxUlp << " ulp at most, " << beyond
+            << " points beyond the bound" << std::endl;
+  std::cout << "---" << std::endl;
+
+
+  // Solving x ^ 2 + y * sqrt(x) - z = 0 for x at the same points, each within
+  // [0, 10]: x is not given, so every point starts in the middle
+  typedef Sub<
+            Add<
+              Mul<Var<VARS_x>, Var<VARS_x>>,
+              Mul<Var<VARS_y>, Sqrt<Var<VARS_x>>>
+            >,
+            Var<VARS_z>
+          > Expr6;
+
+  double lower[points], upper[points], roots[points];
+  unsigned int steps[points];
+  const double *columnsYZ[VARS_count] = {nullptr, columnY, columnZ};
+  for (unsigned int i = 0; i < points; ++i) {
+    lower[i] = 0.;
+    upper[i] = 10.;
+  }
+
+  std::size_t found = Newton<Expr6, VARS_x>::solveBatch(columnsYZ, points, lower, upper,
+                                                        roots, steps);
+
+  double maxResidual = 0.;
+  unsigned int maxSteps = 0;
+  for (unsigned int i = 0; i < points; ++i) {
+    double point[VARS_count] = {roots[i], columnY[i], columnZ[i]};
+    maxResidual = std::fmax(maxResidual, std::fabs(Expr6::eval(point)));
+    maxSteps = steps[i] > maxSteps ? steps[i] : maxSteps;
+  }
+
+  std::cout << "Solved:     " << Newton<Expr6, VARS_x>::toString() << " for x" << std::endl;
+  std::cout << "Roots:      " << found << " of " << points << ", " << maxSteps
+            << " steps at most, residual " << maxResidual << " at most" << std::endl;
+  std::cout << "---" << std::endl;
+
+
+  // Minimizing e^(x + 3y - 0.1) + e^(x - 3y - 0.1) + e^(-x - 0.1) + (z - 1)^2
+  // with L-BFGS, the value and gradient evaluated together in every step; the
+  // minimum is at x = -log(2) / 2, y = 0, z = 1
+  typedef Add<
+            Add<
+              Exp<NumE, Sub<Add<Var<VARS_x>, Mul<Const<3>, Var<VARS_y>>>, Const<1, 10>>>,
+              Exp<NumE, Sub<Sub<Var<VARS_x>, Mul<Const<3>, Var<VARS_y>>>, Const<1, 10>>>
+            >,
+            Add<
+              Exp<NumE, Sub<Neg<Var<VARS_x>>, Const<1, 10>>>,
+              Exp<Sub<Var<VARS_z>, Const<1>>, Const<2>>
+            >
+          > Expr7;
+
+  double minimum[VARS_count] = {1., 1., 1.};
+  double lowest;
+  unsigned int iterations;
+  bool converged = Minimize<Expr7>::run(minimum, lowest, &iterations);
+
+  std::cout << "Minimized:  " << Simplify<Expr7>::Result::toString() << std::endl;
+  std::cout << "Minimum:    " << lowest << " at " << minimum[VARS_x] << ", " << minimum[VARS_y]
+            << ", " << minimum[VARS_z] << (converged ? "" : " (not converged)") << " after "
+            << iterations << " iterations" << std::endl;
+  std::cout << "---" << std::endl;
+
+
+  // The same expressions evaluate in float when given float arguments, which
+  // is faster but less accurate. The relative error stays within a few float
+  // epsilons (1.2e-07), except for the polynomial: near its root at x = 0.78
+  // its terms cancel, which magnifies the error.
+  std::cout << "Float:      " << floatError<Expr1Simp>(columnsXYZ, points) << ", "
+            << floatError<Expr2Simp>(columnsXYZ, points) << ", "
+            << floatError<Expr3Simp>(columnsXYZ, points) << ", "
+            << floatError<Expr3Der>(columnsXYZ, points) << ", "
+            << floatError<Expr4Der>(columnsXYZ, points) << " relative error at most" << std::endl;
+  std::cout << "---" << std::endl;
+
+
+  // An expression can also be turned into a bytecode program, which is plain
+  // data that a single interpreter runs
+  Bytecode program = ToBytecode<Expr4Der>::run();
+
+  std::cout << "Bytecode:   " << program.code.size() << " instructions, "
+            << program.registers << " registers" << std::endl;
+  std::cout << "Evaluated:  " << Interpreter::eval(program, args) << std::endl;
+  std::cout << "---" << std::endl;
+
+
+  // Formulas that are only known at run-time can be parsed, simplified and
+  // derived with the same rules, and then evaluated as bytecode
+  ExpressionGraph graph;
+  unsigned int formula = graph.simplify(graph.parse("(x + y) ^ z"));
+  unsigned int formulaDer = graph.derivative(formula, VARS_z);
+
+  std::cout << "Parsed:     " << graph.toString(formula) << std::endl;
+  std::cout << "Derivative: " << graph.toString(formulaDer) << std::endl;
+  std::cout << "Evaluated:  " << Interpreter::eval(graph.toBytecode(formulaDer), args) << std::endl;
   std::cout << "---" << std::endl;
 
+  // fail where the SIMD evaluation is less accurate than promised
+  return beyond ? 1 : 0;
 }
@@ -0,0 +1,179 @@
+/* Batched root finding
+
+Newton<E, I> solves E = 0 for variable I at many points at once, the other
+variables being given per point. The derivative of E in variable I is taken at
+compile time, and E and its derivative are evaluated together by a SimdBundle
+(see simd.h), so their common subexpressions are computed once per step.
+
+Every lane of a pack is a point of its own. Each point needs a bracket
+[lower, upper] on which E changes sign, which is kept around the root while
+iterating: a Newton step
+  x' = x - E(x) / E'(x)
+is taken where it lands inside the bracket, the bracket is bisected where it
+does not (including where E' is 0 or not finite). This never leaves the
+bracket, and converges quadratically once Newton takes over. A lane is done
+when a step is at most tolerance * max(|x|, 1), when the bracket is that
+small, or when E is exactly 0; lanes that are done are masked out while the
+others go on, and the pack is done when all of its lanes are.
+
+The number of steps of every point is reported. Points whose bracket has no
+change of sign, or that are not done within the maximum number of steps, get a
+NaN root.
+*/
+
+#pragma once
+
+#include "expression.h"
+#include "simplify.h"
+#include "derivative.h"
+#include "simd.h"
+#include "parallel.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+
+
+// default tolerance of a root (relative, at least absolute below 1) and maximum number of Newton steps
+const double NEWTON_TOLERANCE = 4e-16;
+enum { NEWTON_ITERATIONS = 100 };
+
+
+// solves E = 0 for variable I
+template <typename E, unsigned int I>
+struct Newton {
+  typedef typename Simplify<E>::Result F;
+  typedef typename Derivative<F, Var<I>>::Result Slope;
+
+  // E and its derivative in one sweep
+  typedef SimdBundle<F, Slope> Step;
+
+  // solves for n points: variable id of point i is vars[id][i], except
+  // variable I, whose column holds starting guesses or is null to start in
+  // the middle of the bracket; the root of point i is searched in
+  // [lower[i], upper[i]] and stored in roots[i], the number of steps in
+  // iterations[i] unless iterations is null; returns the number of roots found
+  static std::size_t solveBatch(const double *const *vars, std::size_t n,
+                                const double *lower, const double *upper,
+                                double *roots, unsigned int *iterations = nullptr,
+                                double tolerance = NEWTON_TOLERANCE,
+                                unsigned int maxIterations = NEWTON_ITERATIONS) {
+    Pack packs[VARS_count];
+    std::size_t found = 0;
+
+    for (std::size_t i = 0; i < n; i += SIMD_WIDTH) {
+      std::size_t count = n - i < SIMD_WIDTH ? n - i : SIMD_WIDTH;
+
+      for (unsigned int id = 0; id < VARS_count; ++id) {
+        packs[id] = vars[id] ? load(vars[id] + i, count) : splat(0.);
+      }
+      Pack low = load(lower + i, count);
+      Pack high = load(upper + i, count);
+      Pack guess = vars[I] ? packs[I] : (low + high) * 0.5;
+
+      Pack root;
+      PackBits steps;
+      solvePack(packs, low, high, guess, tolerance, maxIterations, root, steps);
+
+      std::memcpy(roots + i, &root, count * sizeof(double));
+      for (std::size_t l = 0; l < count; ++l) {
+        if (iterations) {
+          iterations[i + l] = steps[l];
+        }
+        found += root[l] == root[l];
+      }
+    }
+    return found;
+  }
+
+  // the same, with the points split in chunks over a pool of threads
+  static std::size_t solveBatch(WorkStealingPool &pool, const double *const *vars,
+                                std::size_t n, const double *lower, const double *upper,
+                                double *roots, unsigned int *iterations = nullptr,
+                                double tolerance = NEWTON_TOLERANCE,
+                                unsigned int maxIterations = NEWTON_ITERATIONS,
+                                std::size_t chunk = PARALLEL_CHUNK) {
+    return parallelCount(pool, n, chunk, [&](std::size_t start, std::size_t len) {
+      const double *columns[VARS_count];
+      offsetColumns(vars, start, columns);
+      return solveBatch(columns, len, lower + start, upper + start, roots + start,
+                        iterations ? iterations + start : nullptr,
+                        tolerance, maxIterations);
+    });
+  }
+
+  static std::string toString(void) {
+    return F::toString() + " = 0";
+  }
+
+private:
+  // the lanes of column beyond count are copies of the first, so that the
+  // unused lanes of the last pack take the same steps as a used one
+  static Pack load(const double *column, std::size_t count) {
+    Pack result = splat(column[0]);
+    std::memcpy(&result, column, count * sizeof(double));
+    return result;
+  }
+
+  static Pack value(Pack *packs, Pack x) {
+    packs[I] = x;
+    return Lanes<F>::eval(packs);
+  }
+
+  static void solvePack(Pack *packs, Pack low, Pack high, Pack x,
+                        double tolerance, unsigned int maxIterations,
+                        Pack &root, PackBits &steps) {
+    const Pack nan = splat(std::numeric_limits<double>::quiet_NaN());
+
+    Pack fLow = value(packs, low);
+    Pack fHigh = value(packs, high);
+
+    // an end of the bracket may already be a root
+    PackBits lowRoot = fLow == 0.;
+    PackBits highRoot = fHigh == 0.;
+    root = select(lowRoot, low, select(highRoot, high, nan));
+    steps = PackBits();
+
+    // from here on E(negative) < 0 < E(positive)
+    PackBits bracketed = (fLow < 0. && fHigh > 0.) || (fLow > 0. && fHigh < 0.);
+    PackBits active = bracketed & ~lowRoot & ~highRoot;
+    PackBits flip = fLow > 0.;
+    Pack negative = select(flip, high, low);
+    Pack positive = select(flip, low, high);
+
+    // guesses outside the bracket start in the middle
+    PackBits inside = (x - low) * (x - high) <= 0.;
+    x = select(inside, x, (low + high) * 0.5);
+
+    Pack step[2];
+    for (unsigned int k = 0; k < maxIterations && any(active); ++k) {
+      packs[I] = x;
+      Step::eval(packs, step);
+      Pack f = step[0];
+      steps -= active;
+
+      // the bracket shrinks to the side of the root
+      negative = select(active & (f < 0.), x, negative);
+      positive = select(active & (f > 0.), x, positive);
+
+      // Newton where it stays inside the bracket or is too small to matter,
+      // bisection elsewhere; NaN steps compare false and bisect as well
+      Pack next = x - f / step[1];
+      // relative to |x|, but absolute near 0, where a root such as that of x^3
+      // is approached through ever smaller steps
+      Pack magnitude = vabs(x);
+      Pack scale = splat(tolerance) * select(magnitude > 1., magnitude, splat(1.));
+      PackBits small = vabs(next - x) <= scale;
+      PackBits newton = (next - negative) * (next - positive) < 0.;
+      next = select(newton | small, next, (negative + positive) * 0.5);
+
+      PackBits zero = f == 0.;
+      PackBits converged = active & (zero | small | (vabs(positive - negative) <= scale));
+
+      root = select(converged, select(zero, x, next), root);
+      active &= ~converged;
+      x = select(active, next, x);
+    }
+  }
+};
@@ -0,0 +1,334 @@
+/* Minimization
+
+Minimize<E> minimizes an expression over all variables, from one starting
+point or from many independent ones. The gradient is derived at compile time,
+and the value and all partial derivatives are evaluated in one sweep as a
+Bundle (see cse.h), so what they share is computed once per evaluation.
+
+Every iteration picks a descent direction d and searches along it by
+backtracking: starting from an initial step a, a is halved until
+  E(x + a d) <= E(x) + c a grad(x) . d
+(the Armijo condition, with c = 1e-4). The direction comes from a Method:
+
+  GradientDescent  d = -grad(x), with the initial step twice the last
+                   accepted one, so it follows the scale of the problem
+  LBFGS<M>         d = -H grad(x), where H approximates the inverse Hessian
+                   from the last M steps and changes of the gradient (the
+                   two-loop recursion), with initial step 1; pairs without
+                   positive curvature are skipped
+
+A direction that does not descend is replaced by -grad(x) and the history is
+dropped. A start is done when every partial derivative is within
+tolerance * max(1, |E(x)|) of 0; it fails when the line search finds no
+decrease, or after the maximum number of iterations.
+*/
+
+#pragma once
+
+#include "expression.h"
+#include "simplify.h"
+#include "derivative.h"
+#include "cse.h"
+#include "parallel.h"
+
+#include <cmath>
+#include <cstddef>
+
+
+// default relative tolerance of the partial derivatives at a minimum and
+// maximum number of iterations
+const double MINIMIZE_TOLERANCE = 1e-8;
+enum { MINIMIZE_ITERATIONS = 1000 };
+
+// default number of starting points per chunk, few as a start takes many
+// evaluations
+enum { MINIMIZE_CHUNK = 64 };
+
+
+// the bundle of F and its derivatives in the variables below K, followed by Ds
+template <typename F, unsigned int K = VARS_count, typename... Ds>
+struct GradientBundle {
+  typedef typename GradientBundle<
+            F, K - 1,
+            typename Derivative<F, Var<K - 1>>::Result, Ds...
+          >::Result Result;
+};
+
+template <typename F, typename... Ds>
+struct GradientBundle<F, 0, Ds...> {
+  typedef Bundle<F, Ds...> Result;
+};
+
+// value and gradient of E in one sweep
+template <typename E>
+struct FusedGradient {
+  typedef typename GradientBundle<typename Simplify<E>::Result>::Result Result;
+
+  // returns the value at x and sets grad[id] to the derivative in variable id
+  static double eval(const double *x, double *grad) {
+    double out[1 + VARS_count];
+    Result::eval(x, out);
+
+    for (unsigned int id = 0; id < VARS_count; ++id) {
+      grad[id] = out[1 + id];
+    }
+    return out[0];
+  }
+
+  static std::string toString(void) {
+    return Result::toString();
+  }
+};
+
+
+inline double dot(const double *a, const double *b) {
+  double result = 0.;
+  for (unsigned int id = 0; id < VARS_count; ++id) {
+    result += a[id] * b[id];
+  }
+  return result;
+}
+
+
+// steepest descent
+struct GradientDescent {
+  GradientDescent(void) : last(0.) {}
+
+  void reset(void) {
+    last = 0.;
+  }
+
+  void direction(const double *grad, double *d) const {
+    for (unsigned int id = 0; id < VARS_count; ++id) {
+      d[id] = -grad[id];
+    }
+  }
+
+  // the first step moves every variable by at most 1
+  double initialStep(const double *d) const {
+    if (last > 0.) {
+      return 2. * last;
+    }
+
+    double largest = 0.;
+    for (unsigned int id = 0; id < VARS_count; ++id) {
+      largest = std::fmax(largest, std::fabs(d[id]));
+    }
+    return largest > 1. ? 1. / largest : 1.;
+  }
+
+  // the step s = step * d was taken and changed the gradient by y
+  void update(const double *s, const double *y, double step) {
+    last = step;
+  }
+
+private:
+  double last;
+};
+
+
+// limited memory BFGS with the last M pairs of steps and gradient changes
+template <unsigned int M = 6>
+struct LBFGS {
+  LBFGS(void) : count(0), next(0) {}
+
+  void reset(void) {
+    count = 0;
+    next = 0;
+  }
+
+  void direction(const double *grad, double *d) const {
+    double alpha[M];
+
+    for (unsigned int id = 0; id < VARS_count; ++id) {
+      d[id] = -grad[id];
+    }
+
+    // newest to oldest
+    for (unsigned int k = 0; k < count; ++k) {
+      unsigned int j = (next + M - 1 - k) % M;
+      alpha[j] = rho[j] * dot(s[j], d);
+      for (unsigned int id = 0; id < VARS_count; ++id) {
+        d[id] -= alpha[j] * y[j][id];
+      }
+    }
+
+    // the initial inverse Hessian is s.y / y.y of the newest pair
+    if (count > 0) {
+      unsigned int newest = (next + M - 1) % M;
+      double gamma = 1. / (rho[newest] * dot(y[newest], y[newest]));
+      for (unsigned int id = 0; id < VARS_count; ++id) {
+        d[id] *= gamma;
+      }
+    }
+
+    // oldest to newest
+    for (unsigned int k = count; k > 0; --k) {
+      unsigned int j = (next + M - k) % M;
+      double beta = rho[j] * dot(y[j], d);
+      for (unsigned int id = 0; id < VARS_count; ++id) {
+        d[id] += (alpha[j] - beta) * s[j][id];
+      }
+    }
+  }
+
+  // without a history the first step moves every variable by at most 1
+  double initialStep(const double *d) const {
+    if (count > 0) {
+      return 1.;
+    }
+
+    double largest = 0.;
+    for (unsigned int id = 0; id < VARS_count; ++id) {
+      largest = std::fmax(largest, std::fabs(d[id]));
+    }
+    return largest > 1. ? 1. / largest : 1.;
+  }
+
+  void update(const double *step, const double *change, double) {
+    double curvature = dot(step, change);
+    if (!(curvature > 0.)) {
+      return;
+    }
+
+    for (unsigned int id = 0; id < VARS_count; ++id) {
+      s[next][id] = step[id];
+      y[next][id] = change[id];
+    }
+    rho[next] = 1. / curvature;
+    next = (next + 1) % M;
+    count = count < M ? count + 1 : M;
+  }
+
+private:
+  double s[M][VARS_count];
+  double y[M][VARS_count];
+  double rho[M];
+  unsigned int count;
+  unsigned int next;
+};
+
+
+// minimization of E with a Method, evaluating the value and gradient with an
+// Objective providing
+//   static double eval(const double *x, double *grad)
+template <typename E, typename Method = LBFGS<>, typename Objective = FusedGradient<E>>
+struct Minimize {
+  // minimizes from x, which is overwritten with the minimum; value is set to
+  // the value there; returns whether a minimum was found, iterations (unless
+  // null) is set to the number of iterations taken
+  static bool run(double *x, double &value, unsigned int *iterations = nullptr,
+                  double tolerance = MINIMIZE_TOLERANCE,
+                  unsigned int maxIterations = MINIMIZE_ITERATIONS) {
+    Method method;
+    double grad[VARS_count], d[VARS_count];
+    double trial[VARS_count], trialGrad[VARS_count];
+    double s[VARS_count], y[VARS_count];
+
+    value = Objective::eval(x, grad);
+
+    unsigned int k = 0;
+    for (; k < maxIterations && !small(grad, value, tolerance); ++k) {
+      method.direction(grad, d);
+      double slope = dot(grad, d);
+      if (!(slope < 0.)) {
+        method.reset();
+        GradientDescent().direction(grad, d);
+        slope = dot(grad, d);
+      }
+
+      // backtracking until the decrease is a fraction of the slope, NaN
+      // values compare false and backtrack as well; there is no decrease once
+      // the step no longer moves x
+      double step = method.initialStep(d);
+      double trialValue = 0.;
+      bool accepted = false;
+      for (bool moved = true; moved; step *= 0.5) {
+        moved = false;
+        for (unsigned int id = 0; id < VARS_count; ++id) {
+          trial[id] = x[id] + step * d[id];
+          moved |= trial[id] != x[id];
+        }
+        trialValue = Objective::eval(trial, trialGrad);
+        if (moved && trialValue <= value + 1e-4 * step * slope) {
+          accepted = true;
+          break;
+        }
+      }
+      if (!accepted) {
+        break;
+      }
+
+      for (unsigned int id = 0; id < VARS_count; ++id) {
+        s[id] = trial[id] - x[id];
+        y[id] = trialGrad[id] - grad[id];
+        x[id] = trial[id];
+        grad[id] = trialGrad[id];
+      }
+      value = trialValue;
+      method.update(s, y, step);
+    }
+
+    if (iterations) {
+      *iterations = k;
+    }
+    return small(grad, value, tolerance);
+  }
+
+  // minimizes from n starting points: variable id of start i is vars[id][i],
+  // overwritten with the minimum; values[i] is set to the value there and
+  // iterations[i] (unless null) to the number of iterations; returns the
+  // number of minima found
+  static std::size_t runBatch(double *const *vars, std::size_t n, double *values,
+                              unsigned int *iterations = nullptr,
+                              double tolerance = MINIMIZE_TOLERANCE,
+                              unsigned int maxIterations = MINIMIZE_ITERATIONS) {
+    std::size_t found = 0;
+    double x[VARS_count];
+
+    for (std::size_t i = 0; i < n; ++i) {
+      for (unsigned int id = 0; id < VARS_count; ++id) {
+        x[id] = vars[id][i];
+      }
+
+      found += run(x, values[i], iterations ? iterations + i : nullptr,
+                   tolerance, maxIterations);
+
+      for (unsigned int id = 0; id < VARS_count; ++id) {
+        vars[id][i] = x[id];
+      }
+    }
+    return found;
+  }
+
+  // the same, with the starting points split in chunks over a pool of threads
+  static std::size_t runBatch(WorkStealingPool &pool, double *const *vars, std::size_t n,
+                              double *values, unsigned int *iterations = nullptr,
+                              double tolerance = MINIMIZE_TOLERANCE,
+                              unsigned int maxIterations = MINIMIZE_ITERATIONS,
+                              std::size_t chunk = MINIMIZE_CHUNK) {
+    return parallelCount(pool, n, chunk, [&](std::size_t start, std::size_t len) {
+      double *columns[VARS_count];
+      offsetColumns(vars, start, columns);
+      return runBatch(columns, len, values + start, iterations ? iterations + start : nullptr,
+                      tolerance, maxIterations);
+    });
+  }
+
+  static std::string toString(void) {
+    return Objective::toString();
+  }
+
+private:
+  // the gradient is compared to the value, as it is only known to a few ulp
+  // of the value
+  static bool small(const double *grad, double value, double tolerance) {
+    double scale = tolerance * std::fmax(1., std::fabs(value));
+    for (unsigned int id = 0; id < VARS_count; ++id) {
+      if (!(std::fabs(grad[id]) <= scale)) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
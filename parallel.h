@@ -0,0 +1,323 @@
+/* Parallel evaluation
+
+The points are split in chunks that are evaluated by a pool of threads. Every
+thread starts with its own contiguous range of chunks and takes chunks from
+the front of that range. A thread that runs out of work steals chunks from the
+back of the range of another thread, so threads that get slow chunks or are
+scheduled less often do not hold up the others.
+
+Chunk c always covers the points [c * chunk, (c + 1) * chunk), and its results
+are written to the same positions in the output, so the output does not depend
+on which thread evaluated what.
+
+If a chunk throws, the chunks not yet taken are dropped, the pool waits for
+those under way and the first exception is rethrown to the caller. A pool runs
+one job at a time: calling run( ) while a job runs, from another thread or
+from inside a task, throws std::logic_error.
+*/
+
+#pragma once
+
+#include "expression.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// default number of points per chunk: large enough to amortize taking a chunk,
+// small enough for the columns of a chunk to stay in cache
+enum { PARALLEL_CHUNK = 16 * EVAL_TILE };
+
+
+// the largest number of chunks of a job, as the range of chunks of a thread
+// is kept in two 32-bit halves of one word
+const std::size_t PARALLEL_MAX_CHUNKS = 0xffffffff;
+
+
+// the number of chunks of the given size covering n points, throws
+// std::invalid_argument for empty chunks or too many of them
+inline std::size_t parallelChunks(std::size_t n, std::size_t chunk) {
+  if (chunk == 0) {
+    throw std::invalid_argument("parallel: chunks of 0 points");
+  }
+  std::size_t chunks = n / chunk + (n % chunk != 0);
+  if (chunks > PARALLEL_MAX_CHUNKS) {
+    throw std::invalid_argument("parallel: " + std::to_string(chunks) +
+                                " chunks, at most " + std::to_string(PARALLEL_MAX_CHUNKS));
+  }
+  return chunks;
+}
+
+
+// a pool of threads that run chunked jobs with work stealing, one job at a
+// time: run( ) must not be called while it runs, neither from another thread
+// nor from inside a task (it throws std::logic_error)
+class WorkStealingPool {
+public:
+  // the calling thread also works on the jobs, so this starts threads - 1
+  // threads; by default there is one thread per hardware thread
+  explicit WorkStealingPool(unsigned int threads = 0)
+      : count(threads ? threads : defaultThreads()),
+        ranges(new Range[count]),
+        generation(0),
+        busy(0),
+        stopping(false),
+        running(false) {
+    for (unsigned int self = 1; self < count; ++self) {
+      workers.push_back(std::thread(&WorkStealingPool::loop, this, self));
+    }
+  }
+
+  ~WorkStealingPool(void) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::size_t i = 0; i < workers.size(); ++i) {
+      workers[i].join();
+    }
+  }
+
+  WorkStealingPool(const WorkStealingPool &) = delete;
+  WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+  unsigned int size(void) const {
+    return count;
+  }
+
+  // call task(c) for every chunk 0 <= c < chunks, returns when all are done;
+  // throws std::invalid_argument for more than PARALLEL_MAX_CHUNKS chunks,
+  // std::logic_error while another job runs, and rethrows the first exception
+  // of a task once no chunk is under way any more
+  template <typename Task>
+  void run(std::size_t chunks, const Task &task) {
+    if (chunks > PARALLEL_MAX_CHUNKS) {
+      throw std::invalid_argument("parallel: " + std::to_string(chunks) +
+                                  " chunks, at most " + std::to_string(PARALLEL_MAX_CHUNKS));
+    }
+    if (running.exchange(true)) {
+      throw std::logic_error("parallel: run( ) while the pool runs another job");
+    }
+
+    // every thread starts with an equal share of the chunks
+    for (unsigned int self = 0; self < count; ++self) {
+      std::size_t begin = chunks * self / count;
+      std::size_t end = chunks * (self + 1) / count;
+      ranges[self].bounds.store(pack(begin, end));
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      job = &call<Task>;
+      context = &task;
+      failure = nullptr;
+      busy = count - 1;
+      ++generation;
+    }
+    wake.notify_all();
+
+    work(0);
+
+    std::exception_ptr thrown;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      done.wait(lock, [this] { return busy == 0; });
+      std::swap(thrown, failure);
+    }
+    running = false;
+
+    if (thrown) {
+      std::rethrow_exception(thrown);
+    }
+  }
+
+private:
+  // the range of chunks [begin, end) of a thread, packed in one atomic word
+  // so that the owner and thieves can update it with a single exchange
+  struct Range {
+    std::atomic<unsigned long long> bounds;
+    char padding[64 - sizeof(std::atomic<unsigned long long>)];
+  };
+
+  static unsigned int defaultThreads(void) {
+    unsigned int threads = std::thread::hardware_concurrency();
+    return threads ? threads : 1;
+  }
+
+  static unsigned long long pack(std::size_t begin, std::size_t end) {
+    return ((unsigned long long) begin << 32) | end;
+  }
+
+  template <typename Task>
+  static void call(const void *task, std::size_t chunk) {
+    (*static_cast<const Task *>(task))(chunk);
+  }
+
+  // take the first chunk of the own range
+  bool pop(unsigned int self, std::size_t &chunk) {
+    std::atomic<unsigned long long> &bounds = ranges[self].bounds;
+    unsigned long long current = bounds.load();
+
+    while ((current >> 32) < (current & 0xffffffff)) {
+      std::size_t begin = current >> 32;
+      if (bounds.compare_exchange_weak(current, pack(begin + 1, current & 0xffffffff))) {
+        chunk = begin;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // take the last chunk of the range of another thread
+  bool steal(unsigned int self, std::size_t &chunk) {
+    for (unsigned int i = 1; i < count; ++i) {
+      std::atomic<unsigned long long> &bounds = ranges[(self + i) % count].bounds;
+      unsigned long long current = bounds.load();
+
+      while ((current >> 32) < (current & 0xffffffff)) {
+        std::size_t end = current & 0xffffffff;
+        if (bounds.compare_exchange_weak(current, pack(current >> 32, end - 1))) {
+          chunk = end - 1;
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  // run chunks until there are none left; the first exception is kept for
+  // run( ) and drops all chunks not yet taken
+  void work(unsigned int self) {
+    std::size_t chunk;
+    while (pop(self, chunk) || steal(self, chunk)) {
+      try {
+        job(context, chunk);
+      } catch (...) {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (!failure) {
+            failure = std::current_exception();
+          }
+        }
+        for (unsigned int i = 0; i < count; ++i) {
+          ranges[i].bounds.store(pack(0, 0));
+        }
+      }
+    }
+  }
+
+  void loop(unsigned int self) {
+    unsigned long long seen = 0;
+
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping) {
+          return;
+        }
+        seen = generation;
+      }
+
+      work(self);
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        --busy;
+      }
+      done.notify_one();
+    }
+  }
+
+  unsigned int count;
+  std::unique_ptr<Range[]> ranges;
+  std::vector<std::thread> workers;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  unsigned long long generation;
+  unsigned int busy;
+  bool stopping;
+  std::atomic<bool> running;
+
+  void (*job)(const void *, std::size_t);
+  const void *context;
+  // the first exception of a task of the current job
+  std::exception_ptr failure;
+};
+
+
+// calls f(start, len) for the points [start, start + len) of every chunk of n
+// points, spread over the threads of the pool; throws like parallelChunks( )
+// and WorkStealingPool::run( )
+template <typename F>
+void parallelFor(WorkStealingPool &pool, std::size_t n, std::size_t chunk, const F &f) {
+  pool.run(parallelChunks(n, chunk), [&](std::size_t c) {
+    std::size_t start = c * chunk;
+    f(start, n - start < chunk ? n - start : chunk);
+  });
+}
+
+// the same for f returning a count per chunk, returns the sum of the counts
+template <typename F>
+std::size_t parallelCount(WorkStealingPool &pool, std::size_t n, std::size_t chunk,
+                          const F &f) {
+  std::vector<std::size_t> counts(parallelChunks(n, chunk));
+  parallelFor(pool, n, chunk, [&](std::size_t start, std::size_t len) {
+    counts[start / chunk] = f(start, len);
+  });
+
+  std::size_t total = 0;
+  for (std::size_t c = 0; c < counts.size(); ++c) {
+    total += counts[c];
+  }
+  return total;
+}
+
+// the columns vars from point start on in columns, null columns stay null
+template <typename T>
+void offsetColumns(T *const *vars, std::size_t start, T **columns) {
+  for (unsigned int id = 0; id < VARS_count; ++id) {
+    columns[id] = vars[id] ? vars[id] + start : nullptr;
+  }
+}
+
+
+// parallel batched evaluation with any kernel providing
+//   static void evalBatch(const double *const *vars, std::size_t n, double *out)
+// such as the expressions themselves or SimdEval<E>
+template <typename Kernel>
+struct ParallelEval {
+  static void evalBatch(WorkStealingPool &pool, const double *const *vars,
+                        std::size_t n, double *out,
+                        std::size_t chunk = PARALLEL_CHUNK) {
+    parallelFor(pool, n, chunk, [&](std::size_t start, std::size_t len) {
+      const double *columns[VARS_count];
+      offsetColumns(vars, start, columns);
+      Kernel::evalBatch(columns, len, out + start);
+    });
+  }
+
+  // with a pool of the given number of threads for this evaluation only
+  static void evalBatch(const double *const *vars, std::size_t n, double *out,
+                        unsigned int threads = 0,
+                        std::size_t chunk = PARALLEL_CHUNK) {
+    WorkStealingPool pool(threads);
+    evalBatch(pool, vars, n, out, chunk);
+  }
+
+  static std::string toString(void) {
+    return Kernel::toString();
+  }
+};
@@ -0,0 +1,1046 @@
+/* Polynomials
+
+Evaluated as written, a polynomial like 5x^4 + 2x^3 + 6x^2 + x - 5 costs a
+std::pow per term. Polynomials<E> finds the parts of an expression that are
+polynomials with integer coefficients, collects them into a canonical list of
+coefficients and evaluates that list with Horner's scheme:
+
+  5x^4 + 2x^3 + 6x^2 + x - 5  ->  (((5x + 2)x + 6)x + 1)x - 5
+
+A sum of terms in several variables is split by variable: all terms in x form
+one polynomial, all terms in y another and so on, and the constant terms go
+to the first of them. Terms that mix variables (x * y) or that are not
+polynomials (log( x ), x ^ (-1)) stay as they are, and are searched for
+polynomials further down.
+
+Only sums of monomials c x^k are collected. Products and powers of sums, like
+(x + 1)^12, are left as they are: expanded they can lose all precision to
+cancellation near their roots, and as products they are cheap already.
+
+Horner's scheme needs the fewest operations, but every step waits for the one
+before it. Estrin's scheme evaluates pairs of coefficients independently and
+combines them with x^2, x^4, ..., which costs a few more multiplications but
+leaves wide cores more instructions to execute in parallel:
+
+  Polynomials<E, Estrin>::Result
+
+The coefficients are computed as ints at compile time. A polynomial whose
+expansion overflows an int or whose degree exceeds POLYNOMIAL_MAX_DEGREE
+stays a tree. Both schemes round differently than the tree, so the results
+differ slightly, most of all relative to small values near a root. Lowered
+with the Fused policy (see lower.h), they use fused multiply-adds.
+*/
+
+#pragma once
+
+#include "expression.h"
+#include "simplify.h"
+#include "derivative.h"
+#include "cse.h"
+#include "gradient.h"
+#include "simd.h"
+#include "bytecode.h"
+#include "lower.h"
+#include "codegen.h"
+
+#include <climits>
+
+
+// polynomials of a higher degree are not expanded
+enum { POLYNOMIAL_MAX_DEGREE = 32 };
+
+// the coefficients of c0 + c1 x + ... + cN x^N, the last one is never 0 so
+// the zero polynomial has no coefficients at all (and degree -1)
+template <int... C>
+struct Coefficients {
+  enum { degree = (int) sizeof...(C) - 1 };
+};
+
+// the outcome of polynomial arithmetic on something that is not a polynomial
+struct NotPolynomial {
+  enum { degree = -1 };
+};
+
+template <typename P>
+struct IsCoefficients {
+  enum { value = 0 };
+};
+
+template <int... C>
+struct IsCoefficients<Coefficients<C...>> {
+  enum { value = 1 };
+};
+
+// whether P is a single term c x^k (or 0)
+template <typename P>
+struct IsMonomial {
+  enum { value = 0 };
+};
+
+template <>
+struct IsMonomial<Coefficients<>> {
+  enum { value = 1 };
+};
+
+template <int C>
+struct IsMonomial<Coefficients<C>> {
+  enum { value = 1 };
+};
+
+template <int... Cs>
+struct IsMonomial<Coefficients<0, Cs...>> {
+  enum { value = IsMonomial<Coefficients<Cs...>>::value };
+};
+
+template <>
+struct IsMonomial<Coefficients<0>> {
+  enum { value = 1 };
+};
+
+
+// polynomial arithmetic, anything involving NotPolynomial is NotPolynomial
+
+// C + x P, where C is computed in long long such that overflows show up here
+template <long long C, typename P, bool Fits = (C >= INT_MIN && C <= INT_MAX)>
+struct Prepend {
+  typedef NotPolynomial Result;
+};
+
+template <long long C, int... Cs>
+struct Prepend<C, Coefficients<Cs...>, true> {
+  typedef Coefficients<(int) C, Cs...> Result;
+};
+
+template <>
+struct Prepend<0, Coefficients<>, true> {
+  typedef Coefficients<> Result;
+};
+
+// P + Q
+template <typename P, typename Q>
+struct PolyAdd {
+  typedef NotPolynomial Result;
+};
+
+template <int... Bs>
+struct PolyAdd<Coefficients<>, Coefficients<Bs...>> {
+  typedef Coefficients<Bs...> Result;
+};
+
+template <int A, int... As>
+struct PolyAdd<Coefficients<A, As...>, Coefficients<>> {
+  typedef Coefficients<A, As...> Result;
+};
+
+template <int A, int... As, int B, int... Bs>
+struct PolyAdd<Coefficients<A, As...>, Coefficients<B, Bs...>> {
+  typedef typename Prepend<
+            (long long) A + B,
+            typename PolyAdd<Coefficients<As...>, Coefficients<Bs...>>::Result
+          >::Result Result;
+};
+
+// K * P
+template <int K, typename P>
+struct PolyScale {
+  typedef NotPolynomial Result;
+};
+
+template <int K>
+struct PolyScale<K, Coefficients<>> {
+  typedef Coefficients<> Result;
+};
+
+template <int K, int C, int... Cs>
+struct PolyScale<K, Coefficients<C, Cs...>> {
+  typedef typename Prepend<
+            (long long) K * C,
+            typename PolyScale<K, Coefficients<Cs...>>::Result
+          >::Result Result;
+};
+
+// P * Q = c0 * Q + x (c1 + c2 x + ...) * Q
+template <typename P, typename Q>
+struct PolyMul {
+  typedef NotPolynomial Result;
+};
+
+template <int... Bs>
+struct PolyMul<Coefficients<>, Coefficients<Bs...>> {
+  typedef Coefficients<> Result;
+};
+
+template <int A, int... As, int... Bs>
+struct PolyMul<Coefficients<A, As...>, Coefficients<Bs...>> {
+  typedef typename PolyAdd<
+            typename PolyScale<A, Coefficients<Bs...>>::Result,
+            typename Prepend<
+              0,
+              typename PolyMul<Coefficients<As...>, Coefficients<Bs...>>::Result
+            >::Result
+          >::Result Result;
+};
+
+// P ^ N for N >= 0, as long as the degree stays small enough
+template <typename P, int N,
+          bool Small = (N >= 0 && (long long) N * P::degree <= POLYNOMIAL_MAX_DEGREE)>
+struct PolyPow {
+  typedef NotPolynomial Result;
+};
+
+template <int... C, int N>
+struct PolyPow<Coefficients<C...>, N, true> {
+  typedef typename PolyMul<
+            Coefficients<C...>,
+            typename PolyPow<Coefficients<C...>, N - 1>::Result
+          >::Result Result;
+};
+
+template <int... C>
+struct PolyPow<Coefficients<C...>, 0, true> {
+  typedef Coefficients<1> Result;
+};
+
+// the derivative c1 + 2 c2 x + 3 c3 x^2 + ... of P, K is the power of the
+// first coefficient
+template <typename P, int K = 0>
+struct PolyDerivative {
+  typedef NotPolynomial Result;
+};
+
+template <int K>
+struct PolyDerivative<Coefficients<>, K> {
+  typedef Coefficients<> Result;
+};
+
+template <int C, int... Cs>
+struct PolyDerivative<Coefficients<C, Cs...>, 0> {
+  typedef typename PolyDerivative<Coefficients<Cs...>, 1>::Result Result;
+};
+
+template <int C, int... Cs, int K>
+struct PolyDerivative<Coefficients<C, Cs...>, K> {
+  typedef typename Prepend<
+            (long long) K * C,
+            typename PolyDerivative<Coefficients<Cs...>, K + 1>::Result
+          >::Result Result;
+};
+
+// coefficient I of P
+template <typename P, unsigned int I>
+struct Coefficient;
+
+template <int C, int... Cs>
+struct Coefficient<Coefficients<C, Cs...>, 0> {
+  enum { value = C };
+};
+
+template <int C, int... Cs, unsigned int I>
+struct Coefficient<Coefficients<C, Cs...>, I> {
+  enum { value = Coefficient<Coefficients<Cs...>, I - 1>::value };
+};
+
+// "c0, c1, ..., cN"
+template <typename P>
+struct CoefficientText;
+
+template <int C>
+struct CoefficientText<Coefficients<C>> {
+  typedef typename IntChars<C>::Result Result;
+};
+
+template <int C, int... Cs>
+struct CoefficientText<Coefficients<C, Cs...>> {
+  typedef typename Concat<
+            typename IntChars<C>::Result, Chars<',', ' '>,
+            typename CoefficientText<Coefficients<Cs...>>::Result
+          >::Result Result;
+};
+
+
+// the coefficients of expression E as a polynomial in variable V
+template <typename E, typename V>
+struct PolynomialOf {
+  typedef NotPolynomial Result;
+};
+
+template <int N, typename V>
+struct PolynomialOf<Const<N>, V> {
+  typedef typename Prepend<N, Coefficients<>>::Result Result;
+};
+
+template <unsigned int id>
+struct PolynomialOf<Var<id>, Var<id>> {
+  typedef Coefficients<0, 1> Result;
+};
+
+template <typename E, typename V>
+struct PolynomialOf<Neg<E>, V> {
+  typedef typename PolyScale<
+            -1,
+            typename PolynomialOf<E, V>::Result
+          >::Result Result;
+};
+
+template <typename LHS, typename RHS, typename V>
+struct PolynomialOf<Add<LHS, RHS>, V> {
+  typedef typename PolyAdd<
+            typename PolynomialOf<LHS, V>::Result,
+            typename PolynomialOf<RHS, V>::Result
+          >::Result Result;
+};
+
+template <typename LHS, typename RHS, typename V>
+struct PolynomialOf<Sub<LHS, RHS>, V> {
+  typedef typename PolyAdd<
+            typename PolynomialOf<LHS, V>::Result,
+            typename PolyScale<-1, typename PolynomialOf<RHS, V>::Result>::Result
+          >::Result Result;
+};
+
+// products and powers are only expanded when that does not add up terms
+// P * Q with one of them a monomial
+template <typename P, typename Q,
+          bool Monomial = IsMonomial<P>::value || IsMonomial<Q>::value>
+struct MonomialMul {
+  typedef typename PolyMul<P, Q>::Result Result;
+};
+
+template <typename P, typename Q>
+struct MonomialMul<P, Q, false> {
+  typedef NotPolynomial Result;
+};
+
+// P ^ N with P a monomial
+template <typename P, int N, bool Monomial = IsMonomial<P>::value>
+struct MonomialPow {
+  typedef typename PolyPow<P, N>::Result Result;
+};
+
+template <typename P, int N>
+struct MonomialPow<P, N, false> {
+  typedef NotPolynomial Result;
+};
+
+template <typename LHS, typename RHS, typename V>
+struct PolynomialOf<Mul<LHS, RHS>, V> {
+  typedef typename MonomialMul<
+            typename PolynomialOf<LHS, V>::Result,
+            typename PolynomialOf<RHS, V>::Result
+          >::Result Result;
+};
+
+template <typename E, int N, typename V>
+struct PolynomialOf<Exp<E, Const<N>>, V> {
+  typedef typename MonomialPow<
+            typename PolynomialOf<E, V>::Result,
+            N
+          >::Result Result;
+};
+
+
+// evaluation schemes, the argument x is a scalar or a Pack
+
+// a coefficient in the type of the argument
+template <typename T>
+T broadcast(double c, T x) {
+  return T(c);
+}
+
+inline Pack broadcast(double c, Pack x) {
+  return splat(c);
+}
+
+// a * b + c, rounded once when Fused
+template <bool Fused>
+struct MultiplyAdd {
+  template <typename T>
+  static T run(T a, T b, T c) {
+    return a * b + c;
+  }
+};
+
+template <>
+struct MultiplyAdd<true> {
+  template <typename T>
+  static T run(T a, T b, T c) {
+    return std::fma(a, b, c);
+  }
+
+  static Pack run(Pack a, Pack b, Pack c) {
+    return vfma(a, b, c);
+  }
+};
+
+// c0 + x (c1 + x (c2 + ...)), without the additions of zero coefficients
+template <typename P, bool Fused>
+struct HornerStep;
+
+template <int C, bool Fused>
+struct HornerStep<Coefficients<C>, Fused> {
+  template <typename T>
+  static T value(T x) {
+    return broadcast(C, x);
+  }
+};
+
+template <int C, int... Cs, bool Fused>
+struct HornerStep<Coefficients<C, Cs...>, Fused> {
+  template <typename T>
+  static T value(T x) {
+    return MultiplyAdd<Fused>::run(
+             x, HornerStep<Coefficients<Cs...>, Fused>::value(x), broadcast(C, x));
+  }
+};
+
+template <int... Cs, bool Fused>
+struct HornerStep<Coefficients<0, Cs...>, Fused> {
+  template <typename T>
+  static T value(T x) {
+    return x * HornerStep<Coefficients<Cs...>, Fused>::value(x);
+  }
+};
+
+template <bool Fused>
+struct HornerStep<Coefficients<0>, Fused> {
+  template <typename T>
+  static T value(T x) {
+    return broadcast(0., x);
+  }
+};
+
+template <typename P>
+struct Horner {
+  typedef Chars<'h', 'o', 'r', 'n', 'e', 'r'> Name;
+
+  template <typename T>
+  static T value(T x) {
+    return HornerStep<P, false>::value(x);
+  }
+};
+
+// Horner's scheme with fused multiply-adds, see Lower<> in lower.h
+template <typename P>
+struct FusedHorner {
+  typedef Chars<'f', 'u', 's', 'e', 'd', ' ', 'h', 'o', 'r', 'n', 'e', 'r'> Name;
+
+  template <typename T>
+  static T value(T x) {
+    return HornerStep<P, true>::value(x);
+  }
+};
+
+// the largest power of two below n >= 2, and its exponent
+constexpr unsigned int estrinSplit(unsigned int n, unsigned int half = 1) {
+  return 2 * half >= n ? half : estrinSplit(n, 2 * half);
+}
+
+constexpr unsigned int estrinLevel(unsigned int half) {
+  return half <= 1 ? 0 : 1 + estrinLevel(half / 2);
+}
+
+// the Count coefficients of P from Begin on, split into a lower half and an
+// upper half times x^Half, where powers[k] = x^(2^k)
+template <typename P, unsigned int Begin, unsigned int Count, bool Fused,
+          unsigned int Half = estrinSplit(Count)>
+struct EstrinRange {
+  template <typename T>
+  static T value(const T *powers) {
+    return MultiplyAdd<Fused>::run(
+             powers[estrinLevel(Half)],
+             EstrinRange<P, Begin + Half, Count - Half, Fused>::value(powers),
+             EstrinRange<P, Begin, Half, Fused>::value(powers));
+  }
+};
+
+template <typename P, unsigned int Begin, bool Fused, unsigned int Half>
+struct EstrinRange<P, Begin, 1, Fused, Half> {
+  template <typename T>
+  static T value(const T *powers) {
+    return broadcast(Coefficient<P, Begin>::value, powers[0]);
+  }
+};
+
+template <typename P, bool Fused>
+struct EstrinScheme {
+  enum {
+    size = P::degree + 1,
+    levels = estrinLevel(estrinSplit(size)) + 1
+  };
+
+  template <typename T>
+  static T value(T x) {
+    T powers[levels];
+    powers[0] = x;
+    for (unsigned int k = 1; k < levels; ++k) {
+      powers[k] = powers[k - 1] * powers[k - 1];
+    }
+    return EstrinRange<P, 0, size, Fused>::value(powers);
+  }
+};
+
+template <typename P>
+struct Estrin : EstrinScheme<P, false> {
+  typedef Chars<'e', 's', 't', 'r', 'i', 'n'> Name;
+};
+
+template <typename P>
+struct FusedEstrin : EstrinScheme<P, true> {
+  typedef Chars<'f', 'u', 's', 'e', 'd', ' ', 'e', 's', 't', 'r', 'i', 'n'> Name;
+};
+
+
+// polynomial P (of degree 2 or more) in expression E, evaluated with Scheme
+template <typename E, typename P, template <typename> class Scheme = Horner>
+struct Polynomial {
+  typedef typename PolyDerivative<P>::Result Slope;
+
+  template <typename Args>
+  static typename ScalarOf<Args>::Type eval(const Args &args) {
+    return Scheme<P>::value(E::eval(args));
+  }
+
+  static std::string toString(void) {
+    return textString<Polynomial>();
+  }
+
+  template <typename T>
+  static BasicDual<T> evalDual(const T *args, const T *dir) {
+    BasicDual<T> e = E::evalDual(args, dir);
+    BasicDual<T> result = {Scheme<P>::value(e.value), Scheme<Slope>::value(e.value) * e.tangent};
+    return result;
+  }
+
+  template <typename T>
+  static void evalBatch(const T *const *vars, std::size_t n, T *out) {
+    evalTiled<Polynomial>(vars, n, out);
+  }
+
+  template <typename T>
+  static void evalTile(const T *const *vars, std::size_t n, T *out) {
+    E::evalTile(vars, n, out);
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = Scheme<P>::value(out[i]);
+    }
+  }
+};
+
+// "scheme( E; c0, c1, ..., cN )"
+template <typename E, typename P, template <typename> class Scheme>
+struct Text<Polynomial<E, P, Scheme>> {
+  typedef typename Concat<
+            typename Scheme<P>::Name, Chars<'(', ' '>, typename Text<E>::Result,
+            Chars<';', ' '>, typename CoefficientText<P>::Result, Chars<' ', ')'>
+          >::Result Result;
+};
+
+// P in E as an expression: monomials and lines stay trees
+template <typename E, typename P, template <typename> class Scheme,
+          bool Monomial = IsMonomial<P>::value>
+struct FromCoefficients {
+  typedef Polynomial<E, P, Scheme> Result;
+};
+
+template <typename E, typename P, template <typename> class Scheme>
+struct FromCoefficients<E, P, Scheme, true> {
+  typedef typename Simplify<
+            Mul<
+              Const<Coefficient<P, P::degree>::value>,
+              Exp<E, Const<P::degree>>
+            >
+          >::Result Result;
+};
+
+template <typename E, template <typename> class Scheme>
+struct FromCoefficients<E, Coefficients<>, Scheme, true> {
+  typedef Const<0> Result;
+};
+
+template <typename E, int C, template <typename> class Scheme>
+struct FromCoefficients<E, Coefficients<C>, Scheme, true> {
+  typedef Const<C> Result;
+};
+
+template <typename E, int C0, int C1, template <typename> class Scheme>
+struct FromCoefficients<E, Coefficients<C0, C1>, Scheme, false> {
+  typedef typename Simplify<
+            Add<Mul<Const<C1>, E>, Const<C0>>
+          >::Result Result;
+};
+
+
+// finding the polynomials in an expression
+
+// the smallest variable in E, VARS_count when there is none
+template <typename E>
+struct FirstVar {
+  enum { id = VARS_count };
+};
+
+template <unsigned int V>
+struct FirstVar<Var<V>> {
+  enum { id = V };
+};
+
+template <template <typename> class Op, typename E>
+struct FirstVar<Op<E>> {
+  enum { id = FirstVar<E>::id };
+};
+
+template <template <typename, typename> class Op, typename LHS, typename RHS>
+struct FirstVar<Op<LHS, RHS>> {
+  enum {
+    id = (unsigned int) FirstVar<LHS>::id < (unsigned int) FirstVar<RHS>::id
+         ? (unsigned int) FirstVar<LHS>::id : (unsigned int) FirstVar<RHS>::id
+  };
+};
+
+// the terms of E as a sum appended to list L, subtracted terms are negated
+template <typename E, typename L>
+struct Summands {
+  typedef typename Append<L, E>::Result Result;
+};
+
+template <typename LHS, typename RHS, typename L>
+struct Summands<Add<LHS, RHS>, L> {
+  typedef typename Summands<
+            RHS,
+            typename Summands<LHS, L>::Result
+          >::Result Result;
+};
+
+template <typename LHS, typename RHS, typename L>
+struct Summands<Sub<LHS, RHS>, L> {
+  typedef typename Summands<
+            Neg<RHS>,
+            typename Summands<LHS, L>::Result
+          >::Result Result;
+};
+
+// term T as a polynomial in its first variable, or NotPolynomial
+template <typename T>
+struct TermPolynomial {
+  typedef typename PolynomialOf<T, Var<FirstVar<T>::id>>::Result Result;
+};
+
+// the sum of the terms in list L that are polynomials in variable V (and in
+// no smaller variable), with the constant terms as well if Constants is set
+template <typename L, unsigned int V, bool Constants>
+struct GroupOf;
+
+template <unsigned int V, bool Constants>
+struct GroupOf<NodeList<>, V, Constants> {
+  typedef Coefficients<> Result;
+};
+
+// P + Rest when the term belongs to the group, Rest otherwise
+template <typename P, typename Rest, bool Mine>
+struct GroupAdd {
+  typedef typename PolyAdd<P, Rest>::Result Result;
+};
+
+template <typename P, typename Rest>
+struct GroupAdd<P, Rest, false> {
+  typedef Rest Result;
+};
+
+template <typename T, typename... Ts, unsigned int V, bool Constants>
+struct GroupOf<NodeList<T, Ts...>, V, Constants> {
+  enum {
+    id = FirstVar<T>::id,
+    mine = ((unsigned int) id == V || (Constants && (unsigned int) id == VARS_count))
+           && IsCoefficients<typename TermPolynomial<T>::Result>::value
+  };
+
+  typedef typename GroupAdd<
+            typename TermPolynomial<T>::Result,
+            typename GroupOf<NodeList<Ts...>, V, Constants>::Result,
+            mine
+          >::Result Result;
+};
+
+// the first variable V whose group (with the constants) has degree 2 or more
+// and more than one term, VARS_count if there is none or if some group does
+// not fit
+template <typename L, unsigned int V = 0>
+struct GroupScan {
+  typedef typename GroupOf<L, V, true>::Result Group;
+  typedef GroupScan<L, V + 1> Next;
+
+  enum {
+    valid = IsCoefficients<Group>::value && Next::valid,
+    worth = Group::degree >= 2 && !IsMonomial<Group>::value,
+    first = worth ? V : (unsigned int) Next::first,
+    target = valid ? (unsigned int) first : (unsigned int) VARS_count
+  };
+};
+
+template <typename L>
+struct GroupScan<L, VARS_count> {
+  enum {
+    valid = IsCoefficients<typename GroupOf<L, VARS_count, true>::Result>::value,
+    first = VARS_count
+  };
+};
+
+// node E appended to list L, unless it is 0
+template <typename L, typename E>
+struct AppendNode {
+  typedef typename Append<L, E>::Result Result;
+};
+
+template <typename L>
+struct AppendNode<L, Const<0>> {
+  typedef L Result;
+};
+
+// the polynomials of the terms in list L for variables V and up, appended to
+// list Out, with the constants in the polynomial of variable Target
+template <typename L, unsigned int V, unsigned int Target,
+          template <typename> class Scheme, typename Out>
+struct GroupNodes {
+  typedef typename FromCoefficients<
+            Var<V>,
+            typename GroupOf<L, V, V == Target>::Result,
+            Scheme
+          >::Result Node;
+
+  typedef typename GroupNodes<
+            L,
+            V + 1,
+            Target,
+            Scheme,
+            typename AppendNode<Out, Node>::Result
+          >::Result Result;
+};
+
+template <typename L, unsigned int Target, template <typename> class Scheme, typename Out>
+struct GroupNodes<L, VARS_count, Target, Scheme, Out> {
+  typedef Out Result;
+};
+
+// the sum of the nodes in list L
+template <typename L>
+struct Sum;
+
+template <typename T>
+struct Sum<NodeList<T>> {
+  typedef T Result;
+};
+
+template <typename T, typename... Ts>
+struct Sum<NodeList<T, Ts...>> {
+  typedef Add<T, typename Sum<NodeList<Ts...>>::Result> Result;
+};
+
+template <typename E, template <typename> class Scheme = Horner> struct Polynomials;
+
+// the terms of list L that are not polynomials, appended to list Out after
+// looking for polynomials inside them
+template <typename L, template <typename> class Scheme, typename Out>
+struct RemainingTerms;
+
+template <template <typename> class Scheme, typename Out>
+struct RemainingTerms<NodeList<>, Scheme, Out> {
+  typedef Out Result;
+};
+
+// term T appended to list Out unless it is in one of the polynomials
+template <typename T, template <typename> class Scheme, typename Out,
+          bool Polynomial = IsCoefficients<typename TermPolynomial<T>::Result>::value>
+struct AppendTerm {
+  typedef Out Result;
+};
+
+template <typename T, template <typename> class Scheme, typename Out>
+struct AppendTerm<T, Scheme, Out, false> {
+  typedef typename Append<Out, typename Polynomials<T, Scheme>::Result>::Result Result;
+};
+
+template <typename T, typename... Ts, template <typename> class Scheme, typename Out>
+struct RemainingTerms<NodeList<T, Ts...>, Scheme, Out> {
+  typedef typename RemainingTerms<
+            NodeList<Ts...>,
+            Scheme,
+            typename AppendTerm<T, Scheme, Out>::Result
+          >::Result Result;
+};
+
+// without polynomials in its terms, the subexpressions of E are searched
+template <typename E, template <typename> class Scheme>
+struct PolynomialsBelow {
+  typedef E Result;
+};
+
+template <template <typename> class Op, typename E, template <typename> class Scheme>
+struct PolynomialsBelow<Op<E>, Scheme> {
+  typedef Op<typename Polynomials<E, Scheme>::Result> Result;
+};
+
+template <template <typename, typename> class Op, typename LHS, typename RHS,
+          template <typename> class Scheme>
+struct PolynomialsBelow<Op<LHS, RHS>, Scheme> {
+  typedef Op<
+            typename Polynomials<LHS, Scheme>::Result,
+            typename Polynomials<RHS, Scheme>::Result
+          > Result;
+};
+
+// E as the sum of terms L, rewritten when a variable has a polynomial worth
+// the rewrite
+template <typename E, template <typename> class Scheme, typename L,
+          unsigned int Target = GroupScan<L>::target>
+struct PolynomialTerms {
+  typedef typename Sum<
+            typename RemainingTerms<
+              L,
+              Scheme,
+              typename GroupNodes<L, 0, Target, Scheme, NodeList<>>::Result
+            >::Result
+          >::Result Result;
+};
+
+template <typename E, template <typename> class Scheme, typename L>
+struct PolynomialTerms<E, Scheme, L, VARS_count> {
+  typedef typename PolynomialsBelow<E, Scheme>::Result Result;
+};
+
+// E with its polynomials evaluated by Scheme (Horner or Estrin)
+template <typename E, template <typename> class Scheme>
+struct Polynomials {
+  typedef typename PolynomialTerms<
+            E,
+            Scheme,
+            typename Summands<E, NodeList<>>::Result
+          >::Result Result;
+};
+
+
+// a polynomial node in the other evaluators
+
+template <typename E, typename P, template <typename> class Scheme, typename D>
+struct Derivative<Polynomial<E, P, Scheme>, D> {
+  typedef typename Simplify<
+            Mul<
+              typename FromCoefficients<
+                E,
+                typename PolyDerivative<P>::Result,
+                Scheme
+              >::Result,
+              typename Derivative<E, D>::Result
+            >
+          >::Result Result;
+};
+
+template <typename E, typename P, template <typename> class Scheme, typename L>
+struct Collect<Polynomial<E, P, Scheme>, L, False> {
+  typedef typename Append<
+            typename Collect<E, L>::Result,
+            Polynomial<E, P, Scheme>
+          >::Result Result;
+};
+
+template <typename E, typename P, template <typename> class Scheme>
+struct TreeSize<Polynomial<E, P, Scheme>> {
+  enum { size = 1 + TreeSize<E>::size };
+};
+
+template <typename E, typename P, template <typename> class Scheme, typename L>
+struct SlotNode<Polynomial<E, P, Scheme>, L> {
+  typedef Polynomial<typename SlotRef<E, L>::Result, P, Scheme> Result;
+};
+
+template <typename E, typename P, template <typename> class Scheme, typename L>
+struct CseNode<Polynomial<E, P, Scheme>, L> {
+  template <typename Slots, typename Args>
+  static typename ScalarOf<Slots>::Type eval(const Slots &slots, const Args &args) {
+    return Scheme<P>::value(slots[IndexOf<L, E>::index]);
+  }
+};
+
+// p( A ) -> A: adj * p'( A )
+template <typename E, typename P, template <typename> class Scheme, typename L, unsigned int I>
+struct Adjoint<Polynomial<E, P, Scheme>, L, I> {
+  static void run(const double *slots, double *adj, double *grad) {
+    typedef typename PolyDerivative<P>::Result Slope;
+    adj[IndexOf<L, E>::index] += adj[I] * Scheme<Slope>::value(slots[IndexOf<L, E>::index]);
+  }
+};
+
+template <typename E, typename P, template <typename> class Scheme>
+struct Lanes<Polynomial<E, P, Scheme>> {
+  static Pack eval(const Pack *vars) {
+    return Scheme<P>::value(Lanes<E>::eval(vars));
+  }
+};
+
+// the interpreter runs one instruction after the other, so programs always
+// use Horner's scheme, with fused multiply-adds for the fused schemes
+template <typename P, bool Fused>
+struct EmitHorner;
+
+template <int C, bool Fused>
+struct EmitHorner<Coefficients<C>, Fused> {
+  static unsigned int run(BytecodeBuilder &builder, unsigned int x) {
+    return builder.constant(C);
+  }
+};
+
+template <int C, int... Cs, bool Fused>
+struct EmitHorner<Coefficients<C, Cs...>, Fused> {
+  static unsigned int run(BytecodeBuilder &builder, unsigned int x) {
+    unsigned int rest = EmitHorner<Coefficients<Cs...>, Fused>::run(builder, x);
+    if (Fused) {
+      return builder.ternary(OP_FMA, rest, x, builder.constant(C));
+    }
+    unsigned int product = builder.binary(OP_MUL, rest, x);
+    return builder.binary(OP_ADD, product, builder.constant(C));
+  }
+};
+
+template <int... Cs, bool Fused>
+struct EmitHorner<Coefficients<0, Cs...>, Fused> {
+  static unsigned int run(BytecodeBuilder &builder, unsigned int x) {
+    unsigned int rest = EmitHorner<Coefficients<Cs...>, Fused>::run(builder, x);
+    return builder.binary(OP_MUL, rest, x);
+  }
+};
+
+template <bool Fused>
+struct EmitHorner<Coefficients<0>, Fused> {
+  static unsigned int run(BytecodeBuilder &builder, unsigned int x) {
+    return builder.constant(0);
+  }
+};
+
+template <typename E, typename P, template <typename> class Scheme>
+struct Emit<Polynomial<E, P, Scheme>> {
+  static unsigned int run(BytecodeBuilder &builder) {
+    return EmitHorner<P, false>::run(builder, Emit<E>::run(builder));
+  }
+};
+
+template <typename E, typename P>
+struct Emit<Polynomial<E, P, FusedHorner>> {
+  static unsigned int run(BytecodeBuilder &builder) {
+    return EmitHorner<P, true>::run(builder, Emit<E>::run(builder));
+  }
+};
+
+template <typename E, typename P>
+struct Emit<Polynomial<E, P, FusedEstrin>> {
+  static unsigned int run(BytecodeBuilder &builder) {
+    return EmitHorner<P, true>::run(builder, Emit<E>::run(builder));
+  }
+};
+
+
+// generated source follows the scheme step by step, with x the name of the
+// value of the argument
+template <typename P, bool Fused>
+struct GenerateHorner;
+
+template <int C, bool Fused>
+struct GenerateHorner<Coefficients<C>, Fused> {
+  static std::string run(SourceBuilder &source, const std::string &x) {
+    return sourceLiteral(C);
+  }
+};
+
+template <int C, int... Cs, bool Fused>
+struct GenerateHorner<Coefficients<C, Cs...>, Fused> {
+  static std::string run(SourceBuilder &source, const std::string &x) {
+    std::string rest = GenerateHorner<Coefficients<Cs...>, Fused>::run(source, x);
+    if (Fused) {
+      return source.define("std::fma(" + x + ", " + rest + ", " + sourceLiteral(C) + ")");
+    }
+    return source.define(x + " * " + rest + " + " + sourceLiteral(C));
+  }
+};
+
+template <int... Cs, bool Fused>
+struct GenerateHorner<Coefficients<0, Cs...>, Fused> {
+  static std::string run(SourceBuilder &source, const std::string &x) {
+    return source.define(x + " * " + GenerateHorner<Coefficients<Cs...>, Fused>::run(source, x));
+  }
+};
+
+template <bool Fused>
+struct GenerateHorner<Coefficients<0>, Fused> {
+  static std::string run(SourceBuilder &source, const std::string &x) {
+    return sourceLiteral(0.);
+  }
+};
+
+template <typename P, unsigned int Begin, unsigned int Count, bool Fused,
+          unsigned int Half = estrinSplit(Count)>
+struct GenerateEstrin {
+  static std::string run(SourceBuilder &source, const std::vector<std::string> &powers) {
+    std::string upper = GenerateEstrin<P, Begin + Half, Count - Half, Fused>::run(source, powers);
+    std::string lower = GenerateEstrin<P, Begin, Half, Fused>::run(source, powers);
+    const std::string &power = powers[estrinLevel(Half)];
+    if (Fused) {
+      return source.define("std::fma(" + power + ", " + upper + ", " + lower + ")");
+    }
+    return source.define(power + " * " + upper + " + " + lower);
+  }
+};
+
+template <typename P, unsigned int Begin, bool Fused, unsigned int Half>
+struct GenerateEstrin<P, Begin, 1, Fused, Half> {
+  static std::string run(SourceBuilder &source, const std::vector<std::string> &powers) {
+    return sourceLiteral(Coefficient<P, Begin>::value);
+  }
+};
+
+template <typename P, bool Fused>
+struct GenerateEstrinScheme {
+  static std::string run(SourceBuilder &source, const std::string &x) {
+    typedef EstrinScheme<P, Fused> Scheme;
+
+    std::vector<std::string> powers(1, x);
+    for (unsigned int k = 1; k < Scheme::levels; ++k) {
+      powers.push_back(source.define(powers[k - 1] + " * " + powers[k - 1]));
+    }
+    return GenerateEstrin<P, 0, Scheme::size, Fused>::run(source, powers);
+  }
+};
+
+template <typename E, typename P, typename L>
+struct Generate<Polynomial<E, P, Horner>, L> {
+  static std::string run(SourceBuilder &source, const std::vector<std::string> &values) {
+    return GenerateHorner<P, false>::run(source, values[IndexOf<L, E>::index]);
+  }
+};
+
+template <typename E, typename P, typename L>
+struct Generate<Polynomial<E, P, FusedHorner>, L> {
+  static std::string run(SourceBuilder &source, const std::vector<std::string> &values) {
+    return GenerateHorner<P, true>::run(source, values[IndexOf<L, E>::index]);
+  }
+};
+
+template <typename E, typename P, typename L>
+struct Generate<Polynomial<E, P, Estrin>, L> {
+  static std::string run(SourceBuilder &source, const std::vector<std::string> &values) {
+    return GenerateEstrinScheme<P, false>::run(source, values[IndexOf<L, E>::index]);
+  }
+};
+
+template <typename E, typename P, typename L>
+struct Generate<Polynomial<E, P, FusedEstrin>, L> {
+  static std::string run(SourceBuilder &source, const std::vector<std::string> &values) {
+    return GenerateEstrinScheme<P, true>::run(source, values[IndexOf<L, E>::index]);
+  }
+};
+
+// with the Fused policy of Lower<> the schemes use fused multiply-adds
+template <typename E, typename P>
+struct Lower<Polynomial<E, P, Horner>, Fused> {
+  typedef Polynomial<typename Lower<E, Fused>::Result, P, FusedHorner> Result;
+};
+
+template <typename E, typename P>
+struct Lower<Polynomial<E, P, Estrin>, Fused> {
+  typedef Polynomial<typename Lower<E, Fused>::Result, P, FusedEstrin> Result;
+};
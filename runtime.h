@@ -0,0 +1,837 @@
+/* Expressions at run-time
+
+Formulas that are only known at run-time, as strings like "2 * x ^ 2 + y", are
+parsed into an ExpressionGraph: one graph of nodes shared by all formulas,
+where identical subexpressions are stored once. A formula is referred to by
+the number of its top node.
+
+The graph mirrors the compile-time machinery on these nodes:
+
+  simplify( )    the rules of simplify.h, applied bottom-up in the same way
+  derivative( )  the derivatives of derivative.h, simplified as they are taken
+  toString( )    the same notation as the toString( ) of the expression types
+  toBytecode( )  a program for the interpreter of bytecode.h
+
+so a formula gives the same simplification and derivative as the expression
+type with the same structure. The constants are doubles here, not rationals, so
+they are folded the same way but cannot overflow, and a constant like 1 / 3 is
+rounded and printed as a decimal number.
+
+Simplified forms and derivatives are remembered, such that every node is
+simplified only once, whichever formula it is part of.
+*/
+
+#pragma once
+
+#include "expression.h"
+#include "bytecode.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+// the kinds of nodes, one per expression type of expression.h
+enum NodeKind {
+  NODE_CONST,
+  NODE_VAR,
+  NODE_E,
+  NODE_PI,
+  NODE_NEG,
+  NODE_SQRT,
+  NODE_LOG,
+  NODE_ADD,
+  NODE_SUB,
+  NODE_MUL,
+  NODE_DIV,
+  NODE_EXP
+};
+
+
+class ExpressionGraph {
+public:
+  // a node: the value of a constant, the id of a variable or the numbers of
+  // the subexpressions
+  struct Node {
+    NodeKind kind;
+    double value;
+    unsigned int a;
+    unsigned int b;
+  };
+
+  const Node &node(unsigned int n) const {
+    return nodes[n];
+  }
+
+  std::size_t size(void) const {
+    return nodes.size();
+  }
+
+
+  // building nodes, without any simplification
+
+  unsigned int constant(double value) {
+    return make(NODE_CONST, value, 0, 0);
+  }
+
+  unsigned int variable(unsigned int id) {
+    return make(NODE_VAR, 0., id, 0);
+  }
+
+  unsigned int numberE(void) {
+    return make(NODE_E, 0., 0, 0);
+  }
+
+  unsigned int numberPi(void) {
+    return make(NODE_PI, 0., 0, 0);
+  }
+
+  unsigned int unary(NodeKind kind, unsigned int a) {
+    return make(kind, 0., a, 0);
+  }
+
+  unsigned int binary(NodeKind kind, unsigned int a, unsigned int b) {
+    return make(kind, 0., a, b);
+  }
+
+
+  // parses an infix formula over the variables of expression.h, the numbers e
+  // and pi, sqrt( ) and log( ) with the usual precedence (^ binds strongest and to the
+  // right), throws std::invalid_argument on errors
+  unsigned int parse(const std::string &formula) {
+    Parser parser(*this, formula);
+    unsigned int result = parser.sum();
+    parser.skip();
+    if (parser.pos != formula.size()) {
+      parser.fail("unexpected character");
+    }
+    return result;
+  }
+
+
+  // simplest form of node n under the rules of simplify.h
+  unsigned int simplify(unsigned int n) {
+    std::unordered_map<unsigned int, unsigned int>::iterator found = simplified.find(n);
+    if (found != simplified.end()) {
+      return found->second;
+    }
+
+    // the subexpressions first, then the rules at the top until none applies
+    Node current = nodes[n];
+    unsigned int result = n;
+
+    // A + (- B) -> A - B before B is simplified, as in simplify.h
+    if (current.kind == NODE_ADD && nodes[current.b].kind == NODE_NEG) {
+      current.kind = NODE_SUB;
+      current.b = nodes[current.b].a;
+    }
+
+    if (current.kind >= NODE_NEG) {
+      unsigned int a = simplify(current.a);
+      unsigned int b = current.kind >= NODE_ADD ? simplify(current.b) : 0;
+      result = make(current.kind, 0., a, b);
+
+      unsigned int next = rule(result);
+      if (next != result) {
+        result = simplify(next);
+      }
+    }
+
+    simplified[n] = result;
+    simplified[result] = result;
+    return result;
+  }
+
+  // simplified derivative of node n with respect to variable id
+  unsigned int derivative(unsigned int n, unsigned int id) {
+    std::map<std::pair<unsigned int, unsigned int>, unsigned int>::iterator found =
+      derivatives.find(std::make_pair(n, id));
+    if (found != derivatives.end()) {
+      return found->second;
+    }
+
+    Node current = nodes[n];
+    unsigned int result;
+
+    switch (current.kind) {
+      case NODE_CONST:
+      case NODE_E:
+      case NODE_PI:
+        result = constant(0);
+        break;
+
+      case NODE_VAR:
+        result = constant(current.a == id ? 1 : 0);
+        break;
+
+      // - E -> - E'
+      case NODE_NEG:
+        result = simplify(unary(NODE_NEG, derivative(current.a, id)));
+        break;
+
+      // sqrt( A ) -> A' / (2 * sqrt( A ))
+      case NODE_SQRT:
+        result = simplify(binary(NODE_DIV,
+                                 derivative(current.a, id),
+                                 binary(NODE_MUL, constant(2), n)));
+        break;
+
+      // log( A ) -> A' / A
+      case NODE_LOG:
+        result = simplify(binary(NODE_DIV, derivative(current.a, id), current.a));
+        break;
+
+      // A + B -> A' + B'
+      case NODE_ADD:
+        result = simplify(binary(NODE_ADD,
+                                 derivative(current.a, id),
+                                 derivative(current.b, id)));
+        break;
+
+      // A - B -> A' - B'
+      case NODE_SUB:
+        result = simplify(binary(NODE_SUB,
+                                 derivative(current.a, id),
+                                 derivative(current.b, id)));
+        break;
+
+      // A * B -> A' * B + A * B'
+      case NODE_MUL:
+        result = simplify(binary(NODE_ADD,
+                                 binary(NODE_MUL, derivative(current.a, id), current.b),
+                                 binary(NODE_MUL, current.a, derivative(current.b, id))));
+        break;
+
+      // A / B -> A' / B - A * B' / B ^ 2
+      case NODE_DIV:
+        result = simplify(binary(NODE_SUB,
+                                 binary(NODE_DIV, derivative(current.a, id), current.b),
+                                 binary(NODE_DIV,
+                                        binary(NODE_MUL, current.a, derivative(current.b, id)),
+                                        binary(NODE_EXP, current.b, constant(2)))));
+        break;
+
+      // A ^ B -> B * A ^ (B - 1) * A' + A ^ B * log(A) * B'
+      default:
+        result = simplify(binary(NODE_ADD,
+                                 binary(NODE_MUL,
+                                        binary(NODE_MUL,
+                                               current.b,
+                                               binary(NODE_EXP,
+                                                      current.a,
+                                                      binary(NODE_SUB, current.b, constant(1)))),
+                                        derivative(current.a, id)),
+                                 binary(NODE_MUL,
+                                        binary(NODE_MUL, n, unary(NODE_LOG, current.a)),
+                                        derivative(current.b, id))));
+        break;
+    }
+
+    derivatives[std::make_pair(n, id)] = result;
+    return result;
+  }
+
+
+  std::string toString(unsigned int n) const {
+    const Node &current = nodes[n];
+
+    switch (current.kind) {
+      case NODE_CONST:
+        return constantString(current.value);
+      case NODE_VAR:
+        return varname(current.a);
+      case NODE_E:
+        return "e";
+      case NODE_PI:
+        return "pi";
+      case NODE_NEG:
+        return "( - " + toString(current.a) + " )";
+      case NODE_SQRT:
+        return "sqrt( " + toString(current.a) + " )";
+      case NODE_LOG:
+        return "log( " + toString(current.a) + " )";
+      default:
+        return "( " + toString(current.a) + " " + symbol(current.kind) + " " +
+               toString(current.b) + " )";
+    }
+  }
+
+  // program evaluating node n with the interpreter of bytecode.h
+  Bytecode toBytecode(unsigned int n) const {
+    BytecodeBuilder builder;
+    std::unordered_map<unsigned int, unsigned int> emitted;
+    unsigned int result = emit(n, builder, emitted);
+    return builder.finish(result);
+  }
+
+private:
+  // nodes are unique: the key of a node finds it if it exists already
+  struct Key {
+    unsigned long long value;
+    unsigned int kind;
+    unsigned int a;
+    unsigned int b;
+
+    bool operator==(const Key &other) const {
+      return value == other.value && kind == other.kind && a == other.a && b == other.b;
+    }
+  };
+
+  struct KeyHash {
+    std::size_t operator()(const Key &key) const {
+      unsigned long long h = key.value * 0x9e3779b97f4a7c15ull;
+      h ^= ((unsigned long long) key.kind << 56) ^ ((unsigned long long) key.a << 28) ^ key.b;
+      return h ^ (h >> 29);
+    }
+  };
+
+  unsigned int make(NodeKind kind, double value, unsigned int a, unsigned int b) {
+    // -0 and 0 are the same constant
+    if (value == 0.) {
+      value = 0.;
+    }
+
+    Key key = {0, (unsigned int) kind, a, b};
+    std::memcpy(&key.value, &value, sizeof(value));
+
+    std::unordered_map<Key, unsigned int, KeyHash>::iterator found = known.find(key);
+    if (found != known.end()) {
+      return found->second;
+    }
+
+    Node created = {kind, value, a, b};
+    nodes.push_back(created);
+    known[key] = nodes.size() - 1;
+    return nodes.size() - 1;
+  }
+
+
+  // queries used by the rules
+
+  bool isConst(unsigned int n) const {
+    return nodes[n].kind == NODE_CONST;
+  }
+
+  bool isConst(unsigned int n, double value) const {
+    return nodes[n].kind == NODE_CONST && nodes[n].value == value;
+  }
+
+  // whether n is N * E with a constant N
+  bool isScaled(unsigned int n) const {
+    return nodes[n].kind == NODE_MUL && isConst(nodes[n].a);
+  }
+
+  // whether n is N + E with a constant N
+  bool isShifted(unsigned int n) const {
+    return nodes[n].kind == NODE_ADD && isConst(nodes[n].a);
+  }
+
+  // whether n is E ^ N with a constant N
+  bool isPower(unsigned int n) const {
+    return nodes[n].kind == NODE_EXP && isConst(nodes[n].b);
+  }
+
+  double valueOf(unsigned int n) const {
+    return nodes[n].value;
+  }
+
+
+  // one step of the rules of simplify.h at the top of node n, whose
+  // subexpressions are simplified; returns n when no rule applies
+  // where several rules of simplify.h match, the one the compiler picks (the
+  // most specialized) comes first
+  unsigned int rule(unsigned int n) {
+    Node current = nodes[n];
+    unsigned int a = current.a;
+    unsigned int b = current.b;
+
+    switch (current.kind) {
+      case NODE_NEG:
+        // - N -> (-N)
+        if (isConst(a)) {
+          return constant(- valueOf(a));
+        }
+        // - (-E) -> E
+        if (nodes[a].kind == NODE_NEG) {
+          return nodes[a].a;
+        }
+        // - (N * E) -> (-N) * E
+        if (isScaled(a)) {
+          return binary(NODE_MUL, constant(- valueOf(nodes[a].a)), nodes[a].b);
+        }
+        return n;
+
+      case NODE_ADD:
+        // N + M -> (N+M)
+        if (isConst(a) && isConst(b)) {
+          return constant(valueOf(a) + valueOf(b));
+        }
+        // 0 + E -> E
+        if (isConst(a, 0)) {
+          return b;
+        }
+        // E + 0 -> E
+        if (isConst(b, 0)) {
+          return a;
+        }
+        // (N * E) + (N * E) -> (N+N) * E and E + E -> 2 * E
+        if (a == b) {
+          if (isScaled(a)) {
+            return binary(NODE_MUL, constant(2 * valueOf(nodes[a].a)), nodes[a].b);
+          }
+          return binary(NODE_MUL, constant(2), a);
+        }
+        // E + - E -> 0
+        if (nodes[b].kind == NODE_NEG && nodes[b].a == a) {
+          return constant(0);
+        }
+        // A + (- B) -> A - B
+        if (nodes[b].kind == NODE_NEG) {
+          return binary(NODE_SUB, a, nodes[b].a);
+        }
+        // (A - B) + (B - A) -> 0
+        if (nodes[a].kind == NODE_SUB && nodes[b].kind == NODE_SUB &&
+            nodes[a].a == nodes[b].b && nodes[a].b == nodes[b].a) {
+          return constant(0);
+        }
+        // E + N -> N + E
+        if (isConst(b)) {
+          return binary(NODE_ADD, b, a);
+        }
+        // N + (M + E) -> (N+M) + E
+        if (isConst(a) && isShifted(b)) {
+          return binary(NODE_ADD, constant(valueOf(a) + valueOf(nodes[b].a)), nodes[b].b);
+        }
+        // (N * E) + (M * E) -> (N+M) * E
+        if (isScaled(a) && isScaled(b) && nodes[a].b == nodes[b].b) {
+          return binary(NODE_MUL,
+                        constant(valueOf(nodes[a].a) + valueOf(nodes[b].a)),
+                        nodes[a].b);
+        }
+        return n;
+
+      case NODE_SUB:
+        // N - M -> (N-M)
+        if (isConst(a) && isConst(b)) {
+          return constant(valueOf(a) - valueOf(b));
+        }
+        // E - E -> 0
+        if (a == b) {
+          return constant(0);
+        }
+        // E - 0 -> E
+        if (isConst(b, 0)) {
+          return a;
+        }
+        // 0 - E -> -E
+        if (isConst(a, 0)) {
+          return unary(NODE_NEG, b);
+        }
+        // (-E) - E -> - (2 * E)
+        if (nodes[a].kind == NODE_NEG && nodes[a].a == b) {
+          return unary(NODE_NEG, binary(NODE_MUL, constant(2), b));
+        }
+        // (E - N) - M -> E - (N+M)
+        if (nodes[a].kind == NODE_SUB && isConst(nodes[a].b) && isConst(b)) {
+          return binary(NODE_SUB, nodes[a].a, constant(valueOf(nodes[a].b) + valueOf(b)));
+        }
+        return n;
+
+      case NODE_MUL:
+        // N * M -> (N*M)
+        if (isConst(a) && isConst(b)) {
+          return constant(valueOf(a) * valueOf(b));
+        }
+        // 0 * E -> 0 and E * 0 -> 0
+        if (isConst(a, 0) || isConst(b, 0)) {
+          return constant(0);
+        }
+        // 1 * E -> E
+        if (isConst(a, 1)) {
+          return b;
+        }
+        // E * 1 -> E
+        if (isConst(b, 1)) {
+          return a;
+        }
+        // (N * E) * (N * E) -> (N*N) * (E ^ 2) and E * E -> E ^ 2
+        if (a == b) {
+          if (isScaled(a)) {
+            return binary(NODE_MUL,
+                          constant(valueOf(nodes[a].a) * valueOf(nodes[a].a)),
+                          binary(NODE_EXP, nodes[a].b, constant(2)));
+          }
+          return binary(NODE_EXP, a, constant(2));
+        }
+        // E * (E ^ N) -> E ^ (N+1)
+        if (isPower(b) && nodes[b].a == a) {
+          return binary(NODE_EXP, a, constant(valueOf(nodes[b].b) + 1));
+        }
+        // (E ^ N) * E -> E ^ (N+1)
+        if (isPower(a) && nodes[a].a == b) {
+          return binary(NODE_EXP, b, constant(valueOf(nodes[a].b) + 1));
+        }
+        // E * N -> N * E
+        if (isConst(b)) {
+          return binary(NODE_MUL, b, a);
+        }
+        // N * (M * E) -> (N*M) * E
+        if (isConst(a) && isScaled(b)) {
+          return binary(NODE_MUL, constant(valueOf(a) * valueOf(nodes[b].a)), nodes[b].b);
+        }
+        // N * (M + E) -> (N*M) + N * E
+        if (isConst(a) && isShifted(b)) {
+          return binary(NODE_ADD,
+                        constant(valueOf(a) * valueOf(nodes[b].a)),
+                        binary(NODE_MUL, a, nodes[b].b));
+        }
+        // (N * A) * (M * B) -> (N*M) * (A * B)
+        if (isScaled(a) && isScaled(b)) {
+          return binary(NODE_MUL,
+                        constant(valueOf(nodes[a].a) * valueOf(nodes[b].a)),
+                        binary(NODE_MUL, nodes[a].b, nodes[b].b));
+        }
+        return n;
+
+      case NODE_DIV:
+        // 0 / E -> 0
+        if (isConst(a, 0)) {
+          return constant(0);
+        }
+        // E / 1 -> E
+        if (isConst(b, 1)) {
+          return a;
+        }
+        // N / M -> (N/M), but not for M = 0
+        if (isConst(a) && isConst(b) && valueOf(b) != 0) {
+          return constant(valueOf(a) / valueOf(b));
+        }
+        // (N * E) / M -> (N/M) * E, but not for M = 0
+        if (isScaled(a) && isConst(b)) {
+          if (valueOf(b) == 0) {
+            return n;
+          }
+          return binary(NODE_MUL, constant(valueOf(nodes[a].a) / valueOf(b)), nodes[a].b);
+        }
+        // (N * E) / (M * F) -> (N/M) * (E / F), but not for M = 0
+        if (isScaled(a) && isScaled(b)) {
+          if (valueOf(nodes[b].a) == 0) {
+            return n;
+          }
+          return binary(NODE_MUL,
+                        constant(valueOf(nodes[a].a) / valueOf(nodes[b].a)),
+                        binary(NODE_DIV, nodes[a].b, nodes[b].b));
+        }
+        // E / N -> (1/N) * E, but not for N = 0
+        if (isConst(b) && valueOf(b) != 0) {
+          return binary(NODE_MUL, constant(1 / valueOf(b)), a);
+        }
+        // N / (M * F) -> (N/M) / F, but not for M = 0
+        if (isConst(a) && isScaled(b) && valueOf(nodes[b].a) != 0) {
+          return binary(NODE_DIV, constant(valueOf(a) / valueOf(nodes[b].a)), nodes[b].b);
+        }
+        // E / (N * F) -> (1/N) * (E / F), but not for N = 0
+        if (isScaled(b) && valueOf(nodes[b].a) != 0) {
+          return binary(NODE_MUL,
+                        constant(1 / valueOf(nodes[b].a)),
+                        binary(NODE_DIV, a, nodes[b].b));
+        }
+        // (N * E) / F -> N * (E / F)
+        if (isScaled(a)) {
+          return binary(NODE_MUL, nodes[a].a, binary(NODE_DIV, nodes[a].b, b));
+        }
+        return n;
+
+      case NODE_EXP:
+        // E ^ 0 -> 1
+        if (isConst(b, 0)) {
+          return constant(1);
+        }
+        // E ^ 1 -> E
+        if (isConst(b, 1)) {
+          return a;
+        }
+        // N ^ M -> (N^M) for whole M, negative ones not for N = 0
+        if (isConst(a) && isConst(b) && valueOf(b) == std::floor(valueOf(b)) &&
+            (valueOf(b) > 0 || valueOf(a) != 0)) {
+          return constant(std::pow(valueOf(a), valueOf(b)));
+        }
+        // 1 ^ M -> 1
+        if (isConst(a, 1) && isConst(b)) {
+          return constant(1);
+        }
+        // (E ^ N) ^ M -> E ^ (N*M) for whole N and M
+        if (isPower(a) && isConst(b) && valueOf(b) == std::floor(valueOf(b)) &&
+            valueOf(nodes[a].b) == std::floor(valueOf(nodes[a].b))) {
+          return binary(NODE_EXP, nodes[a].a, constant(valueOf(nodes[a].b) * valueOf(b)));
+        }
+        return n;
+
+      case NODE_SQRT:
+        // sqrt( N ) -> M when N = M ^ 2
+        if (isConst(a) && valueOf(a) >= 0 &&
+            std::sqrt(valueOf(a)) * std::sqrt(valueOf(a)) == valueOf(a)) {
+          return constant(std::sqrt(valueOf(a)));
+        }
+        // sqrt( E ^ 2 ) -> E (note that we pick the positive branch only)
+        if (isPower(a) && valueOf(nodes[a].b) == 2) {
+          return nodes[a].a;
+        }
+        return n;
+
+      case NODE_LOG:
+        // log 1 -> 0
+        if (isConst(a, 1)) {
+          return constant(0);
+        }
+        // log e -> 1
+        if (nodes[a].kind == NODE_E) {
+          return constant(1);
+        }
+        // log( E ^ N) -> N * log( E )
+        if (isPower(a)) {
+          return binary(NODE_MUL, nodes[a].b, unary(NODE_LOG, nodes[a].a));
+        }
+        return n;
+
+      default:
+        return n;
+    }
+  }
+
+
+  static std::string constantString(double value) {
+    if (value == std::floor(value) && std::fabs(value) < 1e18) {
+      return std::to_string((long long) value);
+    }
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+    return buffer;
+  }
+
+  static const char *symbol(NodeKind kind) {
+    switch (kind) {
+      case NODE_ADD:
+        return "+";
+      case NODE_SUB:
+        return "-";
+      case NODE_MUL:
+        return "*";
+      case NODE_DIV:
+        return "/";
+      default:
+        return "^";
+    }
+  }
+
+  unsigned int emit(unsigned int n, BytecodeBuilder &builder,
+                    std::unordered_map<unsigned int, unsigned int> &emitted) const {
+    std::unordered_map<unsigned int, unsigned int>::iterator found = emitted.find(n);
+    if (found != emitted.end()) {
+      return found->second;
+    }
+
+    const Node &current = nodes[n];
+    unsigned int result;
+
+    switch (current.kind) {
+      case NODE_CONST:
+        result = builder.constant(current.value);
+        break;
+      case NODE_VAR:
+        result = builder.variable(current.a);
+        break;
+      case NODE_E:
+        result = builder.constant(double(NUM_E));
+        break;
+      case NODE_PI:
+        result = builder.constant(double(NUM_PI));
+        break;
+      case NODE_NEG:
+        result = builder.unary(OP_NEG, emit(current.a, builder, emitted));
+        break;
+      case NODE_SQRT:
+        result = builder.unary(OP_SQRT, emit(current.a, builder, emitted));
+        break;
+      case NODE_LOG:
+        result = builder.unary(OP_LOG, emit(current.a, builder, emitted));
+        break;
+      default: {
+        static const Opcode ops[] = {OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_POW};
+        unsigned int lhs = emit(current.a, builder, emitted);
+        unsigned int rhs = emit(current.b, builder, emitted);
+        result = builder.binary(ops[current.kind - NODE_ADD], lhs, rhs);
+        break;
+      }
+    }
+
+    emitted[n] = result;
+    return result;
+  }
+
+
+  // recursive descent over
+  //   sum     := product (('+' | '-') product)*
+  //   product := unary (('*' | '/') unary)*
+  //   unary   := '-' unary | power
+  //   power   := atom ('^' unary)?
+  //   atom    := number | variable | 'e' | 'pi' | ('sqrt' | 'log') '(' sum ')' | '(' sum ')'
+  // where a minus sign right before the digits of a number that is no base of
+  // a power gives a negative number, as toString( ) writes a negative constant
+  // (the sum simplifies differently than with the negation of a number)
+  struct Parser {
+    ExpressionGraph &graph;
+    const std::string &text;
+    std::size_t pos;
+
+    Parser(ExpressionGraph &graph, const std::string &text)
+        : graph(graph), text(text), pos(0) {}
+
+    void fail(const char *message) const {
+      throw std::invalid_argument(std::string("parse error: ") + message +
+                                  " at position " + std::to_string(pos) +
+                                  " of \"" + text + "\"");
+    }
+
+    void skip(void) {
+      while (pos < text.size() && std::isspace((unsigned char) text[pos])) {
+        ++pos;
+      }
+    }
+
+    bool accept(char c) {
+      skip();
+      if (pos < text.size() && text[pos] == c) {
+        ++pos;
+        return true;
+      }
+      return false;
+    }
+
+    void expect(char c) {
+      if (!accept(c)) {
+        fail(c == ')' ? "expected )" : "expected (");
+      }
+    }
+
+    unsigned int sum(void) {
+      unsigned int result = product();
+      for (;;) {
+        if (accept('+')) {
+          result = graph.binary(NODE_ADD, result, product());
+        } else if (accept('-')) {
+          result = graph.binary(NODE_SUB, result, product());
+        } else {
+          return result;
+        }
+      }
+    }
+
+    unsigned int product(void) {
+      unsigned int result = unary();
+      for (;;) {
+        if (accept('*')) {
+          result = graph.binary(NODE_MUL, result, unary());
+        } else if (accept('/')) {
+          result = graph.binary(NODE_DIV, result, unary());
+        } else {
+          return result;
+        }
+      }
+    }
+
+    unsigned int unary(void) {
+      if (accept('-')) {
+        std::size_t start = pos;
+        if (pos < text.size() && std::isdigit((unsigned char) text[pos])) {
+          unsigned int number = atom();
+          if (!accept('^')) {
+            return graph.constant(-graph.node(number).value);
+          }
+          pos = start;
+        }
+        return graph.unary(NODE_NEG, unary());
+      }
+      return power();
+    }
+
+    unsigned int power(void) {
+      unsigned int base = atom();
+      if (accept('^')) {
+        return graph.binary(NODE_EXP, base, unary());
+      }
+      return base;
+    }
+
+    unsigned int atom(void) {
+      skip();
+      if (pos == text.size()) {
+        fail("unexpected end");
+      }
+
+      if (accept('(')) {
+        unsigned int result = sum();
+        expect(')');
+        return result;
+      }
+
+      if (std::isdigit((unsigned char) text[pos]) || text[pos] == '.') {
+        const char *begin = text.c_str() + pos;
+        char *end;
+        double value = std::strtod(begin, &end);
+        if (end == begin) {
+          fail("bad number");
+        }
+        pos += end - begin;
+        return graph.constant(value);
+      }
+
+      std::size_t start = pos;
+      while (pos < text.size() && (std::isalnum((unsigned char) text[pos]) || text[pos] == '_')) {
+        ++pos;
+      }
+      std::string name = text.substr(start, pos - start);
+      if (name.empty()) {
+        fail("unexpected character");
+      }
+
+      if (name == "sqrt" || name == "log") {
+        expect('(');
+        unsigned int argument = sum();
+        expect(')');
+        return graph.unary(name == "sqrt" ? NODE_SQRT : NODE_LOG, argument);
+      }
+
+      for (unsigned int id = 0; id < VARS_count; ++id) {
+        if (name == varname(id)) {
+          return graph.variable(id);
+        }
+      }
+
+      if (name == "e") {
+        return graph.numberE();
+      }
+
+      if (name == "pi") {
+        return graph.numberPi();
+      }
+
+      pos = start;
+      fail(("unknown name " + name).c_str());
+      return 0;
+    }
+  };
+
+  std::vector<Node> nodes;
+  std::unordered_map<Key, unsigned int, KeyHash> known;
+  std::unordered_map<unsigned int, unsigned int> simplified;
+  std::map<std::pair<unsigned int, unsigned int>, unsigned int> derivatives;
+};
@@ -0,0 +1,453 @@
+/* Explicit SIMD evaluation
+
+Every expression is evaluated on a whole vector of points at once: one Pack
+holds SIMD_WIDTH doubles and every node maps packs to packs. The width follows
+the instruction set the code is compiled for (AVX-512, AVX, SSE2), without any
+of those a pack holds a single double and this is a plain scalar evaluation.
+
+Arithmetic and square roots give exactly the same results as eval. The vector
+logarithm and exponential are within 1 ulp of std::log and std::exp. Integer
+powers are computed by repeated squaring, which for an exponent N rounds at
+most 2 log2(N) times. Other powers are computed as exp(y * log(x)), which has
+a relative error of roughly (1 + |y * log(x)|) ulp.
+*/
+
+#pragma once
+
+#include "expression.h"
+#include "cse.h"
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+
+// number of doubles in a pack
+#if defined(SIMD_SCALAR)
+#define SIMD_LANES 1
+#elif defined(__AVX512F__)
+#define SIMD_LANES 8
+#elif defined(__AVX__)
+#define SIMD_LANES 4
+#elif defined(__SSE2__)
+#define SIMD_LANES 2
+#else
+#define SIMD_LANES 1
+#endif
+
+enum { SIMD_WIDTH = SIMD_LANES };
+
+// a vector of doubles and a vector of integers (or masks) of the same size
+typedef double Pack __attribute__((vector_size(SIMD_WIDTH * sizeof(double))));
+typedef long long PackBits __attribute__((vector_size(SIMD_WIDTH * sizeof(double))));
+
+
+// all lanes set to the same value
+inline Pack splat(double value) {
+  Pack result;
+  for (unsigned int l = 0; l < SIMD_WIDTH; ++l) {
+    result[l] = value;
+  }
+  return result;
+}
+
+// lanes from then where mask is set, others from otherwise
+inline Pack select(PackBits mask, Pack then, Pack otherwise) {
+  return (Pack) ((mask & (PackBits) then) | (~mask & (PackBits) otherwise));
+}
+
+// whether any of the lanes in mask is set
+inline bool any(PackBits mask) {
+  long long result = 0;
+  for (unsigned int l = 0; l < SIMD_WIDTH; ++l) {
+    result |= mask[l];
+  }
+  return result != 0;
+}
+
+// 2 ^ k for integers -1022 <= k <= 1023
+inline Pack exp2i(PackBits k) {
+  return (Pack) ((k + 1023) << 52);
+}
+
+inline Pack vsqrt(Pack x) {
+#if SIMD_LANES == 8
+  // masked, as GCC warns about the undefined lanes of _mm512_sqrt_pd
+  return (Pack) _mm512_maskz_sqrt_pd((__mmask8) -1, (__m512d) x);
+#elif SIMD_LANES == 4
+  return (Pack) _mm256_sqrt_pd((__m256d) x);
+#elif SIMD_LANES == 2
+  return (Pack) _mm_sqrt_pd((__m128d) x);
+#else
+  return splat(std::sqrt(x[0]));
+#endif
+}
+
+// |x|, by clearing the sign bit
+inline Pack vabs(Pack x) {
+  return (Pack) ((PackBits) x & 0x7fffffffffffffffLL);
+}
+
+// a * b + c rounded once, lane by lane where there is no instruction for it
+inline Pack vfma(Pack a, Pack b, Pack c) {
+#if SIMD_LANES == 8
+  return (Pack) _mm512_fmadd_pd((__m512d) a, (__m512d) b, (__m512d) c);
+#elif SIMD_LANES == 4 && defined(__FMA__)
+  return (Pack) _mm256_fmadd_pd((__m256d) a, (__m256d) b, (__m256d) c);
+#elif SIMD_LANES == 2 && defined(__FMA__)
+  return (Pack) _mm_fmadd_pd((__m128d) a, (__m128d) b, (__m128d) c);
+#else
+  Pack result;
+  for (unsigned int l = 0; l < SIMD_WIDTH; ++l) {
+    result[l] = std::fma(a[l], b[l], c[l]);
+  }
+  return result;
+#endif
+}
+
+// natural logarithm, this is the algorithm of fdlibm's e_log.c without branches
+inline Pack vlog(Pack x) {
+  const double ln2_hi = 6.93147180369123816490e-01;
+  const double ln2_lo = 1.90821492927058770002e-10;
+  const double Lg1 = 6.666666666666735130e-01;
+  const double Lg2 = 3.999999999940941908e-01;
+  const double Lg3 = 2.857142874366239149e-01;
+  const double Lg4 = 2.222219843214978396e-01;
+  const double Lg5 = 1.818357216161805012e-01;
+  const double Lg6 = 1.531383769920937332e-01;
+  const double Lg7 = 1.479819860511658591e-01;
+
+  // scale subnormal numbers up by 2 ^ 54
+  PackBits subnormal = x < 2.2250738585072014e-308;
+  Pack scaled = select(subnormal, x * 18014398509481984., x);
+  PackBits bits = (PackBits) scaled;
+
+  // x = 2 ^ k * m with sqrt(2) / 2 <= m < sqrt(2)
+  PackBits k = ((bits >> 52) & 0x7ff) - 1023 - (subnormal & 54);
+  Pack m = (Pack) ((bits & 0x000fffffffffffffLL) | 0x3ff0000000000000LL);
+  PackBits high = m > 1.4142135623730951;
+  m = select(high, m * .5, m);
+  k -= high;
+
+  Pack f = m - 1.;
+  Pack dk = __builtin_convertvector(k, Pack);
+  Pack s = f / (2. + f);
+  Pack z = s * s;
+  Pack w = z * z;
+  Pack t1 = w * (Lg2 + w * (Lg4 + w * Lg6));
+  Pack t2 = z * (Lg1 + w * (Lg3 + w * (Lg5 + w * Lg7)));
+  Pack R = t2 + t1;
+  Pack hfsq = .5 * f * f;
+  Pack result = dk * ln2_hi - ((hfsq - (s * (hfsq + R) + dk * ln2_lo)) - f);
+
+  // log(0) = -inf, log(inf) = inf, log(x < 0) = nan, log(nan) = nan
+  result = select(x == 0., splat(-HUGE_VAL), result);
+  result = select(x == HUGE_VAL, x, result);
+  result = select(x < 0. || x != x, splat(NAN), result);
+  return result;
+}
+
+// exponential, this is the algorithm of fdlibm's e_exp.c without branches
+inline Pack vexp(Pack x) {
+  const double ln2_hi = 6.93147180369123816490e-01;
+  const double ln2_lo = 1.90821492927058770002e-10;
+  const double inv_ln2 = 1.44269504088896338700e+00;
+  const double P1 = 1.66666666666666019037e-01;
+  const double P2 = -2.77777777770155933842e-03;
+  const double P3 = 6.61375632143793436117e-05;
+  const double P4 = -1.65339022054652515390e-06;
+  const double P5 = 4.13813679705723846039e-08;
+  const double round = 6755399441055744.;
+
+  // x = k * ln(2) + r with |r| <= ln(2) / 2
+  Pack clamped = select(x > 710., splat(710.), select(x < -746., splat(-746.), x));
+  Pack dk = (clamped * inv_ln2 + round) - round;
+  PackBits k = __builtin_convertvector(dk, PackBits);
+  Pack hi = clamped - dk * ln2_hi;
+  Pack lo = dk * ln2_lo;
+  Pack r = hi - lo;
+
+  Pack t = r * r;
+  Pack c = r - t * (P1 + t * (P2 + t * (P3 + t * (P4 + t * P5))));
+  Pack y = 1. - ((lo - (r * c) / (2. - c)) - hi);
+
+  // multiply by 2 ^ k in two steps, to also reach subnormal results
+  PackBits k1 = k >> 1;
+  Pack result = y * exp2i(k1) * exp2i(k - k1);
+
+  // exp(large) = inf, exp(-large) = 0, exp(nan) = nan
+  result = select(x > 709.782712893384, splat(HUGE_VAL), result);
+  result = select(x < -745.1332191019412, splat(0.), result);
+  result = select(x != x, x, result);
+  return result;
+}
+
+// x ^ y for general exponents
+inline Pack vpow(Pack x, Pack y) {
+  // outside of x > 0 with finite x and y fall back to the standard library
+  PackBits regular = x > 0. && x < HUGE_VAL && y > -HUGE_VAL && y < HUGE_VAL;
+  if (any(~regular)) {
+    Pack result;
+    for (unsigned int l = 0; l < SIMD_WIDTH; ++l) {
+      result[l] = std::pow(x[l], y[l]);
+    }
+    return result;
+  }
+
+  return vexp(y * vlog(x));
+}
+
+// x ^ N for integers N, by repeated squaring
+template <int N>
+struct PackPow {
+  static Pack eval(Pack x) {
+    Pack half = PackPow<N / 2>::eval(x);
+    return N % 2 == 0 ? half * half : half * half * x;
+  }
+};
+
+template <>
+struct PackPow<0> {
+  static Pack eval(Pack x) {
+    return splat(1.);
+  }
+};
+
+template <>
+struct PackPow<1> {
+  static Pack eval(Pack x) {
+    return x;
+  }
+};
+
+
+// evaluation of an expression on packs, vars[id] holds the values of variable id
+
+// by default an expression is evaluated lane by lane
+template <typename E>
+struct Lanes {
+  static Pack eval(const Pack *vars) {
+    Pack result;
+    for (unsigned int l = 0; l < SIMD_WIDTH; ++l) {
+      double args[VARS_count];
+      for (unsigned int id = 0; id < VARS_count; ++id) {
+        args[id] = vars[id][l];
+      }
+      result[l] = E::eval(args);
+    }
+    return result;
+  }
+};
+
+template <int N, int D>
+struct Lanes<Const<N, D>> {
+  static Pack eval(const Pack *vars) {
+    return splat(double(N) / D);
+  }
+};
+
+template <unsigned int id>
+struct Lanes<Var<id>> {
+  static Pack eval(const Pack *vars) {
+    return vars[id];
+  }
+};
+
+template <typename E>
+struct Lanes<Neg<E>> {
+  static Pack eval(const Pack *vars) {
+    return - Lanes<E>::eval(vars);
+  }
+};
+
+template <typename E>
+struct Lanes<Sqrt<E>> {
+  static Pack eval(const Pack *vars) {
+    return vsqrt(Lanes<E>::eval(vars));
+  }
+};
+
+template <typename E>
+struct Lanes<Log<E>> {
+  static Pack eval(const Pack *vars) {
+    return vlog(Lanes<E>::eval(vars));
+  }
+};
+
+template <typename LHS, typename RHS>
+struct Lanes<Add<LHS, RHS>> {
+  static Pack eval(const Pack *vars) {
+    return Lanes<LHS>::eval(vars) + Lanes<RHS>::eval(vars);
+  }
+};
+
+template <typename LHS, typename RHS>
+struct Lanes<Sub<LHS, RHS>> {
+  static Pack eval(const Pack *vars) {
+    return Lanes<LHS>::eval(vars) - Lanes<RHS>::eval(vars);
+  }
+};
+
+template <typename LHS, typename RHS>
+struct Lanes<Mul<LHS, RHS>> {
+  static Pack eval(const Pack *vars) {
+    return Lanes<LHS>::eval(vars) * Lanes<RHS>::eval(vars);
+  }
+};
+
+template <typename LHS, typename RHS>
+struct Lanes<Div<LHS, RHS>> {
+  static Pack eval(const Pack *vars) {
+    return Lanes<LHS>::eval(vars) / Lanes<RHS>::eval(vars);
+  }
+};
+
+template <typename LHS, typename RHS>
+struct Lanes<Exp<LHS, RHS>> {
+  static Pack eval(const Pack *vars) {
+    return vpow(Lanes<LHS>::eval(vars), Lanes<RHS>::eval(vars));
+  }
+};
+
+// integer exponents do not need the general power
+template <typename E, int N>
+struct Lanes<Exp<E, Const<N>>> {
+  static Pack eval(const Pack *vars) {
+    Pack power = PackPow<(N < 0 ? -N : N)>::eval(Lanes<E>::eval(vars));
+    return N < 0 ? 1. / power : power;
+  }
+};
+
+template <typename A, typename B, typename C>
+struct Lanes<Fma<A, B, C>> {
+  static Pack eval(const Pack *vars) {
+    return vfma(Lanes<A>::eval(vars), Lanes<B>::eval(vars), Lanes<C>::eval(vars));
+  }
+};
+
+
+// batched evaluation of E using packs, with the same column layout as the
+// batched evaluation in expression.h: vars[id][i] is variable id of point i
+template <typename E>
+struct SimdEval {
+  static void evalBatch(const double *const *vars, std::size_t n, double *out) {
+    Pack packs[VARS_count];
+
+    std::size_t i = 0;
+    for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH) {
+      for (unsigned int id = 0; id < VARS_count; ++id) {
+        packs[id] = vars[id] ? load(vars[id] + i, SIMD_WIDTH) : splat(0.);
+      }
+      Pack result = Lanes<E>::eval(packs);
+      std::memcpy(out + i, &result, sizeof(result));
+    }
+
+    // the remaining points are evaluated in a partially filled pack
+    if (i < n) {
+      for (unsigned int id = 0; id < VARS_count; ++id) {
+        packs[id] = vars[id] ? load(vars[id] + i, n - i) : splat(0.);
+      }
+      Pack result = Lanes<E>::eval(packs);
+      std::memcpy(out + i, &result, (n - i) * sizeof(double));
+    }
+  }
+
+  static std::string toString(void) {
+    return E::toString();
+  }
+
+private:
+  static Pack load(const double *column, std::size_t count) {
+    Pack result = splat(0.);
+    std::memcpy(&result, column, count * sizeof(double));
+    return result;
+  }
+};
+
+
+// walk the nodes still to do front to back, node I of list L goes in
+// values[VARS_count + I] after the values of the variables
+template <typename Todo, typename L, unsigned int I = 0>
+struct LanesSweep;
+
+template <typename L, unsigned int I>
+struct LanesSweep<NodeList<>, L, I> {
+  static void run(Pack *values) {}
+};
+
+template <typename Head, typename... Tail, typename L, unsigned int I>
+struct LanesSweep<NodeList<Head, Tail...>, L, I> {
+  static void run(Pack *values) {
+    values[VARS_count + I] = Lanes<typename SlotNode<Head, L>::Result>::eval(values);
+    LanesSweep<NodeList<Tail...>, L, I + 1>::run(values);
+  }
+};
+
+// the expressions Es evaluated together on packs, every subexpression that
+// appears in any of them once (see Bundle in cse.h)
+template <typename... Es>
+struct SimdBundle {
+  typedef typename Bundle<Es...>::Nodes Nodes;
+
+  enum { outputs = sizeof...(Es) };
+
+  // out[k] is set to the value of expression k
+  static void eval(const Pack *vars, Pack *out) {
+    const unsigned int index[] = {IndexOf<Nodes, Es>::index...};
+    Pack values[VARS_count + Nodes::size];
+
+    for (unsigned int id = 0; id < VARS_count; ++id) {
+      values[id] = vars[id];
+    }
+    LanesSweep<Nodes, Nodes>::run(values);
+
+    for (unsigned int k = 0; k < outputs; ++k) {
+      out[k] = values[VARS_count + index[k]];
+    }
+  }
+
+  // out[k][i] is set to the value of expression k at point i
+  static void evalBatch(const double *const *vars, std::size_t n, double *const *out) {
+    Pack packs[VARS_count];
+    Pack results[outputs];
+
+    for (std::size_t i = 0; i < n; i += SIMD_WIDTH) {
+      std::size_t count = n - i < SIMD_WIDTH ? n - i : SIMD_WIDTH;
+      for (unsigned int id = 0; id < VARS_count; ++id) {
+        packs[id] = splat(0.);
+        if (vars[id]) {
+          std::memcpy(&packs[id], vars[id] + i, count * sizeof(double));
+        }
+      }
+
+      eval(packs, results);
+
+      for (unsigned int k = 0; k < outputs; ++k) {
+        std::memcpy(out[k] + i, &results[k], count * sizeof(double));
+      }
+    }
+  }
+
+  static std::string toString(void) {
+    return Bundle<Es...>::toString();
+  }
+};
+
+
+// number of representable doubles between a and b, to compare results
+inline unsigned long long ulpDistance(double a, double b) {
+  if (a == b || (a != a && b != b)) {
+    return 0;
+  }
+
+  long long ia, ib;
+  std::memcpy(&ia, &a, sizeof(a));
+  std::memcpy(&ib, &b, sizeof(b));
+
+  // order the bit patterns of negative numbers like their values
+  ia = ia < 0 ? (long long) (0x8000000000000000ULL - (unsigned long long) ia) : ia;
+  ib = ib < 0 ? (long long) (0x8000000000000000ULL - (unsigned long long) ib) : ib;
+  return ia < ib ? (unsigned long long) ib - ia : (unsigned long long) ia - ib;
+}
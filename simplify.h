@@ -1,14 +1,26 @@
-/* Simplifications of expressions are done recursively. The typedef in the
-Simplify struct is the output of the current iteration.
-
-The first declaration of the struct Simplify states the general case. By
-template specialization we can then add rules for specific expressions
+/* Simplifications of expressions are done bottom-up. Simplify first
+simplifies the subexpressions of an expression, exactly once each, and then
+tries the rules at the top. A rule is a specialization of the struct Rule: it
+rewrites an expression whose subexpressions are already simplified, in one
+step. When a rule applies, the outcome is simplified again, which only has to
+deal with the parts the rule has built: the subexpressions it reuses have been
+simplified before, and the compiler instantiates Simplify only once for each
+expression. This repeats until no rule applies any more.
+
+The first declaration of the struct Rule states the general case: no rule
+applies. By template specialization we can then add rules for specific
+expressions.
+
+Constants are rationals, so N / M, E / N and negative powers of constants are
+folded at compile time as well, as long as the result fits in a Const.
 */
 
 #pragma once
 
 #include "expression.h"
 
+#include <climits>
+
 
 // helper structure to determine whether two expressions are the same
 struct True {};
@@ -25,705 +37,879 @@ struct IsSame<E,E> {
 };
 
 
-// by default we can just copy the expression
+template <typename E> struct Simplify;
+
+
+// by default no rule applies to an expression
 template <typename E>
-struct Simplify {
+struct Rule {
   typedef E Result;
 };
 
-
-// expressions containing a subexpression need to pass the recursion on
-
-// recursion on negation
-// when subexpressions change upon simplification the negation also needs to be
-// simplified, otherwise not: to avoid infinite recursion
-template <typename E, typename Same>
-struct NegSimplify {
-  typedef typename Simplify<
-            Neg<
-              typename Simplify<E>::Result
-            >
-          >::Result Result;
+// apply rules to E, whose subexpressions are simplified, until none applies
+// when a rule rewrites E, the outcome is simplified as a whole
+template <typename E, typename Next = typename Rule<E>::Result>
+struct Settle {
+  typedef typename Simplify<Next>::Result Result;
 };
 
 template <typename E>
-struct NegSimplify<E, True> {
-  typedef Neg<E> Result;
+struct Settle<E, E> {
+  typedef E Result;
 };
 
+
+// by default we can just copy the expression (constants and variables)
 template <typename E>
-struct Simplify<Neg<E>> {
-  typedef typename NegSimplify<
-            E,
-            typename IsSame<E, typename Simplify<E>::Result>::Answer
-          >::Result Result;
+struct Simplify {
+  typedef E Result;
 };
 
-// recursion on square root
-// when subexpressions change upon simplification the square root also needs to be
-// simplified, otherwise not: to avoid infinite recursion
-template <typename E, typename Same>
-struct SqrtSimplify {
-  typedef typename Simplify<
-            Sqrt<
+// expressions with one subexpression (negation, square root, logarithm)
+template <template <typename> class Op, typename E>
+struct Simplify<Op<E>> {
+  typedef typename Settle<
+            Op<
               typename Simplify<E>::Result
             >
           >::Result Result;
 };
 
-template <typename E>
-struct SqrtSimplify<E, True> {
-  typedef Sqrt<E> Result;
-};
-
-template <typename E>
-struct Simplify<Sqrt<E>> {
-  typedef typename SqrtSimplify<
-            E,
-            typename IsSame<E, typename Simplify<E>::Result>::Answer
+// expressions with two subexpressions (addition, subtraction, multiplication,
+// division, exponent)
+template <template <typename, typename> class Op, typename LHS, typename RHS>
+struct Simplify<Op<LHS, RHS>> {
+  typedef typename Settle<
+            Op<
+              typename Simplify<LHS>::Result,
+              typename Simplify<RHS>::Result
+            >
           >::Result Result;
 };
 
-// recursion on addition
-// when subexpressions change upon simplification the addition also needs to be
-// simplified, otherwise not: to avoid infinite recursion
-template <typename LHS, typename RHS, typename LSame, typename RSame>
-struct AddSimplify {
-  typedef typename Simplify<
-            Add<
+// A + (- B) -> A - B is decided before B is simplified, because simplified a
+// negated constant folds into a negative one: x + (- 5) gives x - 5, while a
+// negative constant x + (-5) gives -5 + x
+template <typename LHS, typename RHS>
+struct Simplify<Add<LHS, Neg<RHS>>> {
+  typedef typename Settle<
+            Sub<
               typename Simplify<LHS>::Result,
               typename Simplify<RHS>::Result
             >
           >::Result Result;
 };
 
-template <typename LHS, typename RHS>
-struct AddSimplify<LHS, RHS, True, True> {
-  typedef Add<LHS, RHS> Result;
+
+// constant arithmetic
+
+// constants are fractions N / ND of ints, computed with in long long. A result
+// that is no Const gives NotConst: one that does not fit in int, a division by
+// zero or an irrational power. The rule that would have produced it then
+// leaves its expression as it is, to be computed at run-time.
+struct NotConst {};
+
+// E, or Otherwise when the constant C in E is NotConst
+template <typename C, typename E, typename Otherwise>
+struct Folded {
+  typedef E Result;
 };
 
-template <typename LHS, typename RHS>
-struct Simplify<Add<LHS, RHS>> {
-  typedef typename AddSimplify<
-            LHS,
-            RHS,
-            typename IsSame<LHS, typename Simplify<LHS>::Result>::Answer,
-            typename IsSame<RHS, typename Simplify<RHS>::Result>::Answer
-          >::Result Result;
+template <typename E, typename Otherwise>
+struct Folded<NotConst, E, Otherwise> {
+  typedef Otherwise Result;
 };
 
-// recursion on subtraction
-// when subexpressions change upon simplification the subtraction also needs to be
-// simplified, otherwise not: to avoid infinite recursion
-template <typename LHS, typename RHS, typename LSame, typename RSame>
-struct SubSimplify {
-  typedef typename Simplify<
-            Sub<
-              typename Simplify<LHS>::Result,
-              typename Simplify<RHS>::Result
-            >
-          >::Result Result;
+constexpr bool fitsInt(long long n) {
+  return n >= INT_MIN && n <= INT_MAX;
+}
+
+constexpr long long cgcd(long long a, long long b) {
+  return b == 0 ? (a < 0 ? -a : a) : cgcd(b, a % b);
+}
+
+// N / D in lowest terms with a positive denominator
+template <long long N, long long D,
+          long long G = (D < 0 ? -1 : 1) * cgcd(N, D),
+          bool Fits = (D != 0 && fitsInt(N / G) && fitsInt(D / G))>
+struct Rational {
+  typedef Const<N / G, D / G> Result;
 };
 
-template <typename LHS, typename RHS>
-struct SubSimplify<LHS, RHS, True, True> {
-  typedef Sub<LHS, RHS> Result;
+template <long long N, long long D, long long G>
+struct Rational<N, D, G, false> {
+  typedef NotConst Result;
 };
 
-template <typename LHS, typename RHS>
-struct Simplify<Sub<LHS, RHS>> {
-  typedef typename SubSimplify<
-            LHS,
-            RHS,
-            typename IsSame<LHS, typename Simplify<LHS>::Result>::Answer,
-            typename IsSame<RHS, typename Simplify<RHS>::Result>::Answer
+template <int N, int ND>
+struct ConstNeg {
+  typedef typename Rational<- (long long) N, ND>::Result Result;
+};
+
+template <int N, int ND, int M, int MD>
+struct ConstAdd {
+  typedef typename Rational<
+            (long long) N * MD + (long long) M * ND,
+            (long long) ND * MD
           >::Result Result;
 };
 
-// recursion on multiplication
-// when subexpressions change upon simplification the multiplication also needs to be
-// simplified, otherwise not: to avoid infinite recursion
-template <typename LHS, typename RHS, typename LSame, typename RSame>
-struct MulSimplify {
-  typedef typename Simplify<
-            Mul<
-              typename Simplify<LHS>::Result,
-              typename Simplify<RHS>::Result
-            >
+template <int N, int ND, int M, int MD>
+struct ConstSub {
+  typedef typename Rational<
+            (long long) N * MD - (long long) M * ND,
+            (long long) ND * MD
           >::Result Result;
 };
 
-template <typename LHS, typename RHS>
-struct MulSimplify<LHS, RHS, True, True> {
-  typedef Mul<LHS, RHS> Result;
+template <int N, int ND, int M, int MD>
+struct ConstMul {
+  typedef typename Rational<(long long) N * M, (long long) ND * MD>::Result Result;
 };
 
-template <typename LHS, typename RHS>
-struct Simplify<Mul<LHS, RHS>> {
-  typedef typename MulSimplify<
-            LHS,
-            RHS,
-            typename IsSame<LHS, typename Simplify<LHS>::Result>::Answer,
-            typename IsSame<RHS, typename Simplify<RHS>::Result>::Answer
-          >::Result Result;
+template <int N, int ND, int M, int MD>
+struct ConstDiv {
+  typedef typename Rational<(long long) N * MD, (long long) ND * M>::Result Result;
 };
 
-// recursion on division
-// when subexpressions change upon simplification the division also needs to be
-// simplified, otherwise not: to avoid infinite recursion
-template <typename LHS, typename RHS, typename LSame, typename RSame>
-struct DivSimplify {
-  typedef typename Simplify<
-            Div<
-              typename Simplify<LHS>::Result,
-              typename Simplify<RHS>::Result
-            >
-          >::Result Result;
+// a * b, or the operand that is already beyond the range of int
+constexpr long long cmul(long long a, long long b) {
+  return !fitsInt(a) ? a : !fitsInt(b) ? b : a * b;
+}
+
+constexpr long long cpowSquare(long long half, long long b, unsigned int e) {
+  return cmul(cmul(half, half), e % 2 ? b : 1);
+}
+
+// b ^ e by repeated squaring, beyond the range of int once it leaves it
+constexpr long long cpow(long long b, unsigned int e) {
+  return e == 0 ? 1 : cpowSquare(cpow(b, e / 2), b, e);
+}
+
+template <long long N, long long D, bool Fits = fitsInt(N) && fitsInt(D)>
+struct PowRational {
+  typedef typename Rational<N, D>::Result Result;
 };
 
-template <typename LHS, typename RHS>
-struct DivSimplify<LHS, RHS, True, True> {
-  typedef Div<LHS, RHS> Result;
+template <long long N, long long D>
+struct PowRational<N, D, false> {
+  typedef NotConst Result;
 };
 
-template <typename LHS, typename RHS>
-struct Simplify<Div<LHS, RHS>> {
-  typedef typename DivSimplify<
-            LHS,
-            RHS,
-            typename IsSame<LHS, typename Simplify<LHS>::Result>::Answer,
-            typename IsSame<RHS, typename Simplify<RHS>::Result>::Answer
-          >::Result Result;
+// (N / ND) ^ M for whole M, other powers are irrational unless N / ND is 1
+template <int N, int ND, int M, int MD, bool Whole = (MD == 1), bool Negative = (M < 0)>
+struct ConstPow {
+  typedef typename PowRational<cpow(N, M), cpow(ND, M)>::Result Result;
 };
 
-// recursion on exponent
-// when subexpressions change upon simplification the exponent also needs to be
-// simplified, otherwise not: to avoid infinite recursion
-template <typename LHS, typename RHS, typename LSame, typename RSame>
-struct ExpSimplify {
-  typedef typename Simplify<
-            Exp<
-              typename Simplify<LHS>::Result,
-              typename Simplify<RHS>::Result
-            >
+template <int N, int ND, int M, int MD>
+struct ConstPow<N, ND, M, MD, true, true> {
+  typedef typename PowRational<
+            cpow(ND, - (long long) M),
+            cpow(N, - (long long) M)
           >::Result Result;
 };
 
-template <typename LHS, typename RHS>
-struct ExpSimplify<LHS, RHS, True, True> {
-  typedef Exp<LHS, RHS> Result;
+template <int N, int ND, int M, int MD, bool Negative>
+struct ConstPow<N, ND, M, MD, false, Negative> {
+  typedef NotConst Result;
 };
 
-template <typename LHS, typename RHS>
-struct Simplify<Exp<LHS, RHS>> {
-  typedef typename ExpSimplify<
-            LHS,
-            RHS,
-            typename IsSame<LHS, typename Simplify<LHS>::Result>::Answer,
-            typename IsSame<RHS, typename Simplify<RHS>::Result>::Answer
-          >::Result Result;
+template <int M, int MD, bool Negative>
+struct ConstPow<1, 1, M, MD, false, Negative> {
+  typedef Const<1> Result;
+};
+
+// the largest r in [lo, hi) with r * r <= n, for 0 <= n <= INT_MAX
+constexpr long long csqrt(long long n, long long lo = 0, long long hi = 46341) {
+  return hi - lo <= 1 ? lo
+       : (lo + hi) / 2 * ((lo + hi) / 2) <= n ? csqrt(n, (lo + hi) / 2, hi)
+       : csqrt(n, lo, (lo + hi) / 2);
+}
+
+// sqrt( N / ND ) when both are squares
+template <int N, int ND,
+          bool Square = (csqrt(N) * csqrt(N) == N && csqrt(ND) * csqrt(ND) == ND)>
+struct ConstSqrt {
+  typedef Const<csqrt(N), csqrt(ND)> Result;
+};
+
+template <int N, int ND>
+struct ConstSqrt<N, ND, false> {
+  typedef NotConst Result;
+};
+
+// constants are brought in lowest terms, except N / 0
+template <int N, int ND>
+struct Simplify<Const<N, ND>> {
+  typedef typename Rational<N, ND>::Result C;
+  typedef typename Folded<C, C, Const<N, ND>>::Result Result;
 };
 
 
 // here the simplification rules start
 
 // - N -> (-N)
-template <int N>
-struct Simplify<Neg<Const<N>>> {
-  typedef Const<-N> Result;
+template <int N, int ND>
+struct Rule<Neg<Const<N, ND>>> {
+  typedef typename ConstNeg<N, ND>::Result C;
+  typedef typename Folded<C, C, Neg<Const<N, ND>>>::Result Result;
 };
 
 // - (-E) -> E
 template <typename E>
-struct Simplify<Neg<Neg<E>>> {
-  typedef typename Simplify<E>::Result Result;
+struct Rule<Neg<Neg<E>>> {
+  typedef E Result;
 };
 
 // E + E -> 2 * E
 template <typename E>
-struct Simplify<Add<E,E>> {
-  typedef typename Simplify<
-            Mul<
-              Const<2>,
-              typename Simplify<E>::Result
-            >
-          >::Result Result;
+struct Rule<Add<E,E>> {
+  typedef Mul<Const<2>, E> Result;
 };
 
 // E + 0 -> E
 template <typename E>
-struct Simplify<Add<E,Const<0>>> {
-  typedef typename Simplify<E>::Result Result;
+struct Rule<Add<E,Const<0>>> {
+  typedef E Result;
 };
 
 // 0 + E -> E
 template <typename E>
-struct Simplify<Add<Const<0>, E>> {
-  typedef typename Simplify<E>::Result Result;
+struct Rule<Add<Const<0>, E>> {
+  typedef E Result;
 };
 
 // E + - E -> 0
 template <typename E>
-struct Simplify<Add<E, Neg<E>>> {
+struct Rule<Add<E, Neg<E>>> {
   typedef Const<0> Result;
 };
 
 // A + (- B) -> A - B
 template <typename LHS, typename RHS>
-struct Simplify<Add<LHS, Neg<RHS>>> {
-  typedef typename Simplify<
-            Sub<
-              typename Simplify<LHS>::Result,
-              typename Simplify<RHS>::Result
-            >
-          >::Result Result;
+struct Rule<Add<LHS, Neg<RHS>>> {
+  typedef Sub<LHS, RHS> Result;
 };
 
 // (A - B) + (B - A) -> 0
 template <typename LHS, typename RHS>
-struct Simplify<Add<Sub<LHS, RHS>, Sub<RHS, LHS>>> {
+struct Rule<Add<Sub<LHS, RHS>, Sub<RHS, LHS>>> {
   typedef Const<0> Result;
 };
 
 // E + N -> N + E
-template <int N, typename E>
-struct Simplify<Add<E, Const<N>>> {
-  typedef typename Simplify<
-            Add<
-              Const<N>,
-              typename Simplify<E>::Result
-            >
-          >::Result Result;
+template <int N, int ND, typename E>
+struct Rule<Add<E, Const<N, ND>>> {
+  typedef Add<Const<N, ND>, E> Result;
 };
 
 // N + (M + E) -> (N+M) + E
-template <int N, int M, typename E>
-struct Simplify<Add<Const<N>, Add<Const<M>, E>>> {
-  typedef typename Simplify<
-            Add<
-              Const<N+M>,
-              typename Simplify<E>::Result
-            >
+template <int N, int ND, int M, int MD, typename E>
+struct Rule<Add<Const<N, ND>, Add<Const<M, MD>, E>>> {
+  typedef typename ConstAdd<N, ND, M, MD>::Result C;
+  typedef typename Folded<
+            C,
+            Add<C, E>,
+            Add<Const<N, ND>, Add<Const<M, MD>, E>>
           >::Result Result;
 };
 
 // (N * E) + (M * E) -> (N+M) * E
-template <int N, int M, typename E>
-struct Simplify<Add<Mul<Const<N>, E>, Mul<Const<M>, E>>> {
-  typedef typename Simplify<
-            Mul<
-              Const<N+M>,
-              typename Simplify<E>::Result
-            >
+template <int N, int ND, int M, int MD, typename E>
+struct Rule<Add<Mul<Const<N, ND>, E>, Mul<Const<M, MD>, E>>> {
+  typedef typename ConstAdd<N, ND, M, MD>::Result C;
+  typedef typename Folded<
+            C,
+            Mul<C, E>,
+            Add<Mul<Const<N, ND>, E>, Mul<Const<M, MD>, E>>
           >::Result Result;
 };
 
 // (N * E) + (N * E) -> (N+N) * E
 // this specialization is to avoid ambiguity
-template <int N, typename E>
-struct Simplify<Add<Mul<Const<N>, E>, Mul<Const<N>, E>>> {
-  typedef typename Simplify<
-            Mul<
-              Const<N+N>,
-              typename Simplify<E>::Result
-            >
+template <int N, int ND, typename E>
+struct Rule<Add<Mul<Const<N, ND>, E>, Mul<Const<N, ND>, E>>> {
+  typedef typename ConstAdd<N, ND, N, ND>::Result C;
+  typedef typename Folded<
+            C,
+            Mul<C, E>,
+            Add<Mul<Const<N, ND>, E>, Mul<Const<N, ND>, E>>
           >::Result Result;
 };
 
 // N + M -> (N+M)
-template <int N, int M>
-struct Simplify<Add<Const<N>, Const<M>>> {
-  typedef Const<N+M> Result;
+template <int N, int ND, int M, int MD>
+struct Rule<Add<Const<N, ND>, Const<M, MD>>> {
+  typedef typename ConstAdd<N, ND, M, MD>::Result C;
+  typedef typename Folded<C, C, Add<Const<N, ND>, Const<M, MD>>>::Result Result;
+};
+
+// N + N -> (N+N)
+// this specialization is to avoid ambiguity
+template <int N, int ND>
+struct Rule<Add<Const<N, ND>, Const<N, ND>>> {
+  typedef typename ConstAdd<N, ND, N, ND>::Result C;
+  typedef typename Folded<C, C, Add<Const<N, ND>, Const<N, ND>>>::Result Result;
 };
 
 // 0 + 0 -> 0
 // this specialization is to avoid ambiguity
 template <>
-struct Simplify<Add<Const<0>, Const<0>>> {
+struct Rule<Add<Const<0>, Const<0>>> {
   typedef Const<0> Result;
 };
 
 // 0 + N -> N
 // this specialization is to avoid ambiguity
-template <int N>
-struct Simplify<Add<Const<0>, Const<N>>> {
-  typedef Const<N> Result;
+template <int N, int ND>
+struct Rule<Add<Const<0>, Const<N, ND>>> {
+  typedef Const<N, ND> Result;
 };
 
 // N + 0 -> N
 // this specialization is to avoid ambiguity
-template <int N>
-struct Simplify<Add<Const<N>, Const<0>>> {
-  typedef Const<N> Result;
+template <int N, int ND>
+struct Rule<Add<Const<N, ND>, Const<0>>> {
+  typedef Const<N, ND> Result;
+};
+
+// 0 + (M + E) -> M + E
+// this specialization is to avoid ambiguity
+template <int M, int MD, typename E>
+struct Rule<Add<Const<0>, Add<Const<M, MD>, E>>> {
+  typedef Add<Const<M, MD>, E> Result;
+};
+
+// 0 + (- E) -> - E
+// this specialization is to avoid ambiguity
+template <typename E>
+struct Rule<Add<Const<0>, Neg<E>>> {
+  typedef Neg<E> Result;
 };
 
 // E - E -> 0
 template <typename E>
-struct Simplify<Sub<E, E>> {
+struct Rule<Sub<E, E>> {
   typedef Const<0> Result;
 };
 
 // (-E) - E -> - (2 * E)
 template <typename E>
-struct Simplify<Sub<Neg<E>, E>> {
-  typedef typename Simplify<
-            Neg<
-              typename Simplify<
-                Mul<
-                  Const<2>,
-                  typename Simplify<E>::Result
-                >
-              >::Result
-            >
-          >::Result Result;
+struct Rule<Sub<Neg<E>, E>> {
+  typedef Neg<Mul<Const<2>, E>> Result;
 };
 
 // E - 0 -> E
 template <typename E>
-struct Simplify<Sub<E, Const<0>>> {
-  typedef typename Simplify<E>::Result Result;
+struct Rule<Sub<E, Const<0>>> {
+  typedef E Result;
 };
 
 // 0 - E -> -E
 template <typename E>
-struct Simplify<Sub<Const<0>, E>> {
-  typedef Neg<typename Simplify<E>::Result> Result;
+struct Rule<Sub<Const<0>, E>> {
+  typedef Neg<E> Result;
+};
+
+// (E - N) - M -> E - (N+M)
+template <typename E, int N, int ND, int M, int MD>
+struct Rule<Sub<Sub<E, Const<N, ND>>, Const<M, MD>>> {
+  typedef typename ConstAdd<N, ND, M, MD>::Result C;
+  typedef typename Folded<
+            C,
+            Sub<E, C>,
+            Sub<Sub<E, Const<N, ND>>, Const<M, MD>>
+          >::Result Result;
+};
+
+// (E - N) - 0 -> E - N
+// this specialization is to avoid ambiguity
+template <typename E, int N, int ND>
+struct Rule<Sub<Sub<E, Const<N, ND>>, Const<0>>> {
+  typedef Sub<E, Const<N, ND>> Result;
 };
 
 // N - M -> (N-M)
-template <int N, int M>
-struct Simplify<Sub<Const<N>, Const<M>>> {
-  typedef Const<N-M> Result;
+template <int N, int ND, int M, int MD>
+struct Rule<Sub<Const<N, ND>, Const<M, MD>>> {
+  typedef typename ConstSub<N, ND, M, MD>::Result C;
+  typedef typename Folded<C, C, Sub<Const<N, ND>, Const<M, MD>>>::Result Result;
 };
 
 // 0 - N -> (-N)
 // this specialization is to avoid ambiguity
-template <int N>
-struct Simplify<Sub<Const<0>, Const<N>>> {
-  typedef Const<-N> Result;
+template <int N, int ND>
+struct Rule<Sub<Const<0>, Const<N, ND>>> {
+  typedef typename ConstNeg<N, ND>::Result C;
+  typedef typename Folded<C, C, Sub<Const<0>, Const<N, ND>>>::Result Result;
 };
 
 // N - 0 -> N
 // this specialization is to avoid ambiguity
-template <int N>
-struct Simplify<Sub<Const<N>, Const<0>>> {
-  typedef Const<N> Result;
+template <int N, int ND>
+struct Rule<Sub<Const<N, ND>, Const<0>>> {
+  typedef Const<N, ND> Result;
+};
+
+// N - N -> 0
+// this specialization is to avoid ambiguity
+template <int N, int ND>
+struct Rule<Sub<Const<N, ND>, Const<N, ND>>> {
+  typedef Const<0> Result;
 };
 
 // 0 - 0 -> 0
 // this specialization is to avoid ambiguity
 template <>
-struct Simplify<Sub<Const<0>, Const<0>>> {
+struct Rule<Sub<Const<0>, Const<0>>> {
   typedef Const<0> Result;
 };
 
 // E * E -> E ^ 2
 template <typename E>
-struct Simplify<Mul<E, E>> {
-  typedef typename Exp<
-            typename Simplify<E>::Result,
-            Const<2>
-          >::Result Result;
+struct Rule<Mul<E, E>> {
+  typedef Exp<E, Const<2>> Result;
 };
 
 // E * (E ^ N) -> E ^ (N+1)
-template <int N, typename E>
-struct Simplify<Mul<E, Exp<E, Const<N>>>> {
-  typedef typename Exp<
-            typename Simplify<E>::Result,
-            Const<N+1>
-          >::Result Result;
+template <int N, int ND, typename E>
+struct Rule<Mul<E, Exp<E, Const<N, ND>>>> {
+  typedef typename ConstAdd<N, ND, 1, 1>::Result C;
+  typedef typename Folded<C, Exp<E, C>, Mul<E, Exp<E, Const<N, ND>>>>::Result Result;
 };
 
 // (E ^ N) * E -> E ^ (N+1)
-template <int N, typename E>
-struct Simplify<Mul<Exp<E, Const<N>>, E>> {
-  typedef typename Simplify<
-            Exp<
-              typename Simplify<E>::Result,
-              Const<N+1>
-            >
+template <int N, int ND, typename E>
+struct Rule<Mul<Exp<E, Const<N, ND>>, E>> {
+  typedef typename ConstAdd<N, ND, 1, 1>::Result C;
+  typedef typename Folded<C, Exp<E, C>, Mul<Exp<E, Const<N, ND>>, E>>::Result Result;
+};
+
+// (M ^ N) * M -> M ^ (N+1), for powers of constants that do not fit
+// this specialization is to avoid ambiguity
+template <int N, int ND, int M, int MD>
+struct Rule<Mul<Exp<Const<M, MD>, Const<N, ND>>, Const<M, MD>>> {
+  typedef typename ConstAdd<N, ND, 1, 1>::Result C;
+  typedef typename Folded<
+            C,
+            Exp<Const<M, MD>, C>,
+            Mul<Exp<Const<M, MD>, Const<N, ND>>, Const<M, MD>>
           >::Result Result;
 };
 
 // E * N -> N * E
-template <int N, typename E>
-struct Simplify<Mul<E, Const<N>>> {
-  typedef typename Simplify<
-            Mul<
-              Const<N>,
-              typename Simplify<E>::Result
-            >
-          >::Result Result;
+template <int N, int ND, typename E>
+struct Rule<Mul<E, Const<N, ND>>> {
+  typedef Mul<Const<N, ND>, E> Result;
 };
 
 // - (N * E) -> (-N) * E
-template <int N, typename E>
-struct Simplify<Neg<Mul<Const<N>, E>>> {
-  typedef typename Simplify<
-            Mul<
-              Const<-N>,
-              typename Simplify<E>::Result
-            >
-          >::Result Result;
+template <int N, int ND, typename E>
+struct Rule<Neg<Mul<Const<N, ND>, E>>> {
+  typedef typename ConstNeg<N, ND>::Result C;
+  typedef typename Folded<C, Mul<C, E>, Neg<Mul<Const<N, ND>, E>>>::Result Result;
 };
 
 // N * (M * E) -> (N*M) * E
-template <int N, int M, typename E>
-struct Simplify<Mul<Const<N>, Mul<Const<M>,E>>> {
-  typedef typename Simplify<
-            Mul<
-              Const<N*M>,
-              typename Simplify<E>::Result
-            >
+template <int N, int ND, int M, int MD, typename E>
+struct Rule<Mul<Const<N, ND>, Mul<Const<M, MD>, E>>> {
+  typedef typename ConstMul<N, ND, M, MD>::Result C;
+  typedef typename Folded<
+            C,
+            Mul<C, E>,
+            Mul<Const<N, ND>, Mul<Const<M, MD>, E>>
           >::Result Result;
 };
 
 // N * (M + E) -> (N*M) + N * E
-template <int N, int M, typename E>
-struct Simplify<Mul<Const<N>, Add<Const<M>, E>>> {
-  typedef typename Simplify<
+template <int N, int ND, int M, int MD, typename E>
+struct Rule<Mul<Const<N, ND>, Add<Const<M, MD>, E>>> {
+  typedef typename ConstMul<N, ND, M, MD>::Result C;
+  typedef typename Folded<
+            C,
             Add<
-              Const<N*M>,
-              Mul<
-                Const<N>,
-                typename Simplify<E>::Result
-              >
-            >
+              C,
+              Mul<Const<N, ND>, E>
+            >,
+            Mul<Const<N, ND>, Add<Const<M, MD>, E>>
           >::Result Result;
 };
 
 // (N * A) * (M * B) -> (N*M) * (A * B)
-template <int N, int M, typename E1, typename E2>
-struct Simplify<Mul<Mul<Const<N>,E1>,Mul<Const<M>,E2>>> {
-  typedef typename Simplify<
-            Mul<
-              Const<N*M>,
-              typename Simplify<
-                Mul<E1, E2>
-              >::Result
-            >
+template <int N, int ND, int M, int MD, typename E1, typename E2>
+struct Rule<Mul<Mul<Const<N, ND>,E1>,Mul<Const<M, MD>,E2>>> {
+  typedef typename ConstMul<N, ND, M, MD>::Result C;
+  typedef typename Folded<
+            C,
+            Mul<C, Mul<E1, E2>>,
+            Mul<Mul<Const<N, ND>,E1>,Mul<Const<M, MD>,E2>>
           >::Result Result;
 };
 
 // (N * A) * (N * B) -> (N*N) * (A * B)
 // this template specialization is to avoid ambiguity
-template <int N, typename E1, typename E2>
-struct Simplify<Mul<Mul<Const<N>,E1>,Mul<Const<N>,E2>>> {
-  typedef typename Simplify<
-            Mul<
-              Const<N*N>,
-              typename Simplify<
-                Mul<E1, E2>
-              >::Result
-            >
+template <int N, int ND, typename E1, typename E2>
+struct Rule<Mul<Mul<Const<N, ND>,E1>,Mul<Const<N, ND>,E2>>> {
+  typedef typename ConstMul<N, ND, N, ND>::Result C;
+  typedef typename Folded<
+            C,
+            Mul<C, Mul<E1, E2>>,
+            Mul<Mul<Const<N, ND>,E1>,Mul<Const<N, ND>,E2>>
           >::Result Result;
 };
 
 // (N * E) * (N * E) -> (N*N) * (E ^ 2)
 // this template specialization is to avoid ambiguity
-template <int N, typename E>
-struct Simplify<Mul<Mul<Const<N>,E>,Mul<Const<N>,E>>> {
-  typedef typename Simplify<
+template <int N, int ND, typename E>
+struct Rule<Mul<Mul<Const<N, ND>,E>,Mul<Const<N, ND>,E>>> {
+  typedef typename ConstMul<N, ND, N, ND>::Result C;
+  typedef typename Folded<
+            C,
             Mul<
-              Const<N*N>,
-              typename Simplify<
-                Exp<E, Const<2>>
-              >::Result
-            >
+              C,
+              Exp<E, Const<2>>
+            >,
+            Mul<Mul<Const<N, ND>,E>,Mul<Const<N, ND>,E>>
           >::Result Result;
 };
 
 // E * 1 -> E
 template <typename E>
-struct Simplify<Mul<E, Const<1>>> {
-  typedef typename Simplify<E>::Result Result;
+struct Rule<Mul<E, Const<1>>> {
+  typedef E Result;
 };
 
 // 1 * E -> E
 template <typename E>
-struct Simplify<Mul<Const<1>, E>> {
-  typedef typename Simplify<E>::Result Result;
+struct Rule<Mul<Const<1>, E>> {
+  typedef E Result;
 };
 
 // E * 0 -> 0
 template <typename E>
-struct Simplify<Mul<E, Const<0>>> {
+struct Rule<Mul<E, Const<0>>> {
   typedef Const<0> Result;
 };
 
 // 0 * E -> 0
 template <typename E>
-struct Simplify<Mul<Const<0>, E>> {
+struct Rule<Mul<Const<0>, E>> {
   typedef Const<0> Result;
 };
 
-
 // N * M -> (N*M)
-template <int N, int M>
-struct Simplify<Mul<Const<N>, Const<M>>> {
-  typedef Const<N*M> Result;
+template <int N, int ND, int M, int MD>
+struct Rule<Mul<Const<N, ND>, Const<M, MD>>> {
+  typedef typename ConstMul<N, ND, M, MD>::Result C;
+  typedef typename Folded<C, C, Mul<Const<N, ND>, Const<M, MD>>>::Result Result;
 };
 
 // N * 1 -> N
-template <int N>
-struct Simplify<Mul<Const<N>, Const<1>>> {
-  typedef Const<N> Result;
+template <int N, int ND>
+struct Rule<Mul<Const<N, ND>, Const<1>>> {
+  typedef Const<N, ND> Result;
 };
 
 // 1 * N -> N
-template <int N>
-struct Simplify<Mul<Const<1>, Const<N>>> {
-  typedef Const<N> Result;
+template <int N, int ND>
+struct Rule<Mul<Const<1>, Const<N, ND>>> {
+  typedef Const<N, ND> Result;
 };
 
 // N * 0 -> 0
-template <int N>
-struct Simplify<Mul<Const<N>, Const<0>>> {
+template <int N, int ND>
+struct Rule<Mul<Const<N, ND>, Const<0>>> {
   typedef Const<0> Result;
 };
 
 // 0 * N -> 0
-template <int N>
-struct Simplify<Mul<Const<0>, Const<N>>> {
+template <int N, int ND>
+struct Rule<Mul<Const<0>, Const<N, ND>>> {
   typedef Const<0> Result;
 };
 
+// N * N -> (N*N)
+// this specialization is to avoid ambiguity
+template <int N, int ND>
+struct Rule<Mul<Const<N, ND>, Const<N, ND>>> {
+  typedef typename ConstMul<N, ND, N, ND>::Result C;
+  typedef typename Folded<C, C, Mul<Const<N, ND>, Const<N, ND>>>::Result Result;
+};
+
 // 0 * 0 -> 0
 template <>
-struct Simplify<Mul<Const<0>, Const<0>>> {
+struct Rule<Mul<Const<0>, Const<0>>> {
   typedef Const<0> Result;
 };
 
 // 1 * 1 -> 1
 template <>
-struct Simplify<Mul<Const<1>, Const<1>>> {
+struct Rule<Mul<Const<1>, Const<1>>> {
   typedef Const<1> Result;
 };
 
 // 0 * 1 -> 0
 template <>
-struct Simplify<Mul<Const<0>, Const<1>>> {
+struct Rule<Mul<Const<0>, Const<1>>> {
   typedef Const<0> Result;
 };
 
 // 1 * 0 -> 0
 template <>
-struct Simplify<Mul<Const<1>, Const<0>>> {
+struct Rule<Mul<Const<1>, Const<0>>> {
+  typedef Const<0> Result;
+};
+
+// 1 * (M * E) -> M * E
+// this specialization is to avoid ambiguity
+template <int M, int MD, typename E>
+struct Rule<Mul<Const<1>, Mul<Const<M, MD>, E>>> {
+  typedef Mul<Const<M, MD>, E> Result;
+};
+
+// 0 * (M * E) -> 0
+// this specialization is to avoid ambiguity
+template <int M, int MD, typename E>
+struct Rule<Mul<Const<0>, Mul<Const<M, MD>, E>>> {
+  typedef Const<0> Result;
+};
+
+// 1 * (M + E) -> M + E
+// this specialization is to avoid ambiguity
+template <int M, int MD, typename E>
+struct Rule<Mul<Const<1>, Add<Const<M, MD>, E>>> {
+  typedef Add<Const<M, MD>, E> Result;
+};
+
+// 0 * (M + E) -> 0
+// this specialization is to avoid ambiguity
+template <int M, int MD, typename E>
+struct Rule<Mul<Const<0>, Add<Const<M, MD>, E>>> {
+  typedef Const<0> Result;
+};
+
+// 0 * (0 ^ N) -> 0
+// this specialization is to avoid ambiguity
+template <int N, int ND>
+struct Rule<Mul<Const<0>, Exp<Const<0>, Const<N, ND>>>> {
+  typedef Const<0> Result;
+};
+
+// (0 ^ N) * 0 -> 0
+// this specialization is to avoid ambiguity
+template <int N, int ND>
+struct Rule<Mul<Exp<Const<0>, Const<N, ND>>, Const<0>>> {
   typedef Const<0> Result;
 };
 
 // E / 1 -> E
 template <typename E>
-struct Simplify<Div<E, Const<1>>> {
-  typedef typename Simplify<E>::Result Result;
+struct Rule<Div<E, Const<1>>> {
+  typedef E Result;
 };
 
 // 0 / E -> 0
 template <typename E>
-struct Simplify<Div<Const<0>, E>> {
+struct Rule<Div<Const<0>, E>> {
   typedef Const<0> Result;
 };
 
-// E ^ 0 -> 1
-template <typename E>
-struct Simplify<Exp<E, Const<0>>> {
-  typedef Const<1> Result;
+// E / N -> (1/N) * E, but not for N = 0
+template <int N, int ND, typename E>
+struct Rule<Div<E, Const<N, ND>>> {
+  typedef typename Rational<ND, N>::Result C;
+  typedef typename Folded<C, Mul<C, E>, Div<E, Const<N, ND>>>::Result Result;
 };
 
-// E ^ 1 -> E
-template <typename E>
-struct Simplify<Exp<E, Const<1>>> {
-  typedef typename Simplify<E>::Result Result;
+// E / (N * F) -> (1/N) * (E / F), but not for N = 0
+template <int N, int ND, typename E, typename F>
+struct Rule<Div<E, Mul<Const<N, ND>, F>>> {
+  typedef typename Rational<ND, N>::Result C;
+  typedef typename Folded<
+            C,
+            Mul<C, Div<E, F>>,
+            Div<E, Mul<Const<N, ND>, F>>
+          >::Result Result;
 };
 
-// function to compute power of integers
-constexpr unsigned int cpow(unsigned int b, unsigned int e)
-{
-  return e == 0 ? 1 : b * pow(b, e-1);
+// N / (M * F) -> (N/M) / F, but not for M = 0
+template <int N, int ND, int M, int MD, typename F>
+struct Rule<Div<Const<N, ND>, Mul<Const<M, MD>, F>>> {
+  typedef typename ConstDiv<N, ND, M, MD>::Result C;
+  typedef typename Folded<
+            C,
+            Div<C, F>,
+            Div<Const<N, ND>, Mul<Const<M, MD>, F>>
+          >::Result Result;
 };
 
-// N ^ M -> (N^M)
-template <int N, int M>
-struct Simplify<Exp<Const<N>, Const<M>>> {
-  typedef Const<cpow(N,M)> Result;
+// (N * E) / F -> N * (E / F)
+template <int N, int ND, typename E, typename F>
+struct Rule<Div<Mul<Const<N, ND>, E>, F>> {
+  typedef Mul<Const<N, ND>, Div<E, F>> Result;
 };
 
-// N ^ 0 -> 1
-template <int N>
-struct Simplify<Exp<Const<N>, Const<0>>> {
-  typedef Const<1> Result;
+// (N * E) / 1 -> N * E
+// this specialization is to avoid ambiguity
+template <int N, int ND, typename E>
+struct Rule<Div<Mul<Const<N, ND>, E>, Const<1>>> {
+  typedef Mul<Const<N, ND>, E> Result;
 };
 
-// N ^ 1 -> N
-template <int N>
-struct Simplify<Exp<Const<N>, Const<1>>> {
-  typedef Const<N> Result;
+// (N * E) / M -> (N/M) * E, but not for M = 0
+// this specialization is to avoid ambiguity
+template <int N, int ND, int M, int MD, typename E>
+struct Rule<Div<Mul<Const<N, ND>, E>, Const<M, MD>>> {
+  typedef typename ConstDiv<N, ND, M, MD>::Result C;
+  typedef typename Folded<
+            C,
+            Mul<C, E>,
+            Div<Mul<Const<N, ND>, E>, Const<M, MD>>
+          >::Result Result;
 };
 
-// sqrt( 0 ) -> 0
-template <>
-struct Simplify<Sqrt<Const<0>>> {
+// (N * E) / (M * F) -> (N/M) * (E / F), but not for M = 0
+// this specialization is to avoid ambiguity
+template <int N, int ND, int M, int MD, typename E, typename F>
+struct Rule<Div<Mul<Const<N, ND>, E>, Mul<Const<M, MD>, F>>> {
+  typedef typename ConstDiv<N, ND, M, MD>::Result C;
+  typedef typename Folded<
+            C,
+            Mul<C, Div<E, F>>,
+            Div<Mul<Const<N, ND>, E>, Mul<Const<M, MD>, F>>
+          >::Result Result;
+};
+
+// N / M -> (N/M), but not for M = 0
+template <int N, int ND, int M, int MD>
+struct Rule<Div<Const<N, ND>, Const<M, MD>>> {
+  typedef typename ConstDiv<N, ND, M, MD>::Result C;
+  typedef typename Folded<C, C, Div<Const<N, ND>, Const<M, MD>>>::Result Result;
+};
+
+// N / 1 -> N
+// this specialization is to avoid ambiguity
+template <int N, int ND>
+struct Rule<Div<Const<N, ND>, Const<1>>> {
+  typedef Const<N, ND> Result;
+};
+
+// 0 / M -> 0
+// this specialization is to avoid ambiguity
+template <int M, int MD>
+struct Rule<Div<Const<0>, Const<M, MD>>> {
   typedef Const<0> Result;
 };
 
-// sqrt( 1 ) -> 1
+// 0 / 1 -> 0
+// this specialization is to avoid ambiguity
 template <>
-struct Simplify<Sqrt<Const<1>>> {
+struct Rule<Div<Const<0>, Const<1>>> {
+  typedef Const<0> Result;
+};
+
+// 0 / (N * F) -> 0
+// this specialization is to avoid ambiguity
+template <int N, int ND, typename F>
+struct Rule<Div<Const<0>, Mul<Const<N, ND>, F>>> {
+  typedef Const<0> Result;
+};
+
+// E ^ 0 -> 1
+template <typename E>
+struct Rule<Exp<E, Const<0>>> {
   typedef Const<1> Result;
 };
 
-// sqrt( 4 ) -> 2
-template <>
-struct Simplify<Sqrt<Const<4>>> {
-  typedef Const<2> Result;
+// E ^ 1 -> E
+template <typename E>
+struct Rule<Exp<E, Const<1>>> {
+  typedef E Result;
 };
 
-// sqrt( 9 ) -> 3
-template <>
-struct Simplify<Sqrt<Const<9>>> {
-  typedef Const<3> Result;
+// (E ^ N) ^ M -> E ^ (N*M) for whole N and M, (x ^ (1/2)) ^ 2 is no x for
+// negative x
+template <typename E, int N, int ND, int M, int MD, bool Whole = ND == 1 && MD == 1>
+struct PowerOfPower {
+  typedef Exp<Exp<E, Const<N, ND>>, Const<M, MD>> Result;
 };
 
-// sqrt( 16 ) -> 4
-template <>
-struct Simplify<Sqrt<Const<16>>> {
-  typedef Const<4> Result;
+template <typename E, int N, int ND, int M, int MD>
+struct PowerOfPower<E, N, ND, M, MD, true> {
+  typedef typename ConstMul<N, ND, M, MD>::Result C;
+  typedef typename Folded<
+            C,
+            Exp<E, C>,
+            Exp<Exp<E, Const<N, ND>>, Const<M, MD>>
+          >::Result Result;
 };
 
-// sqrt( 25 ) -> 5
-template <>
-struct Simplify<Sqrt<Const<25>>> {
-  typedef Const<5> Result;
+template <typename E, int N, int ND, int M, int MD>
+struct Rule<Exp<Exp<E, Const<N, ND>>, Const<M, MD>>> {
+  typedef typename PowerOfPower<E, N, ND, M, MD>::Result Result;
+};
+
+// (E ^ N) ^ 0 -> 1
+// this specialization is to avoid ambiguity
+template <typename E, int N, int ND>
+struct Rule<Exp<Exp<E, Const<N, ND>>, Const<0>>> {
+  typedef Const<1> Result;
+};
+
+// (E ^ N) ^ 1 -> E ^ N
+// this specialization is to avoid ambiguity
+template <typename E, int N, int ND>
+struct Rule<Exp<Exp<E, Const<N, ND>>, Const<1>>> {
+  typedef Exp<E, Const<N, ND>> Result;
+};
+
+// N ^ M -> (N^M) for whole M, also negative ones; 1 ^ M -> 1 for any M
+template <int N, int ND, int M, int MD>
+struct Rule<Exp<Const<N, ND>, Const<M, MD>>> {
+  typedef typename ConstPow<N, ND, M, MD>::Result C;
+  typedef typename Folded<C, C, Exp<Const<N, ND>, Const<M, MD>>>::Result Result;
+};
+
+// N ^ 0 -> 1
+template <int N, int ND>
+struct Rule<Exp<Const<N, ND>, Const<0>>> {
+  typedef Const<1> Result;
+};
+
+// N ^ 1 -> N
+template <int N, int ND>
+struct Rule<Exp<Const<N, ND>, Const<1>>> {
+  typedef Const<N, ND> Result;
+};
+
+// sqrt( N ) -> M when N = M ^ 2, like sqrt( 9 / 4 ) -> 3 / 2
+template <int N, int ND>
+struct Rule<Sqrt<Const<N, ND>>> {
+  typedef typename ConstSqrt<N, ND>::Result C;
+  typedef typename Folded<C, C, Sqrt<Const<N, ND>>>::Result Result;
 };
 
 // sqrt( E ^ 2 ) -> E (note that we pick the positive branch only)
 template <typename E>
-struct Simplify<Sqrt<Exp<E, Const<2>>>> {
-  typedef typename Simplify<E>::Result Result;
+struct Rule<Sqrt<Exp<E, Const<2>>>> {
+  typedef E Result;
 };
 
 // log 1 -> 0
 template <>
-struct Simplify<Log<Const<0>>> {
+struct Rule<Log<Const<1>>> {
   typedef Const<0> Result;
 };
 
 // log e -> 1
 template <>
-struct Simplify<Log<NumE>> {
+struct Rule<Log<NumE>> {
   typedef Const<1> Result;
 };
 
 // log( E ^ N) -> N * log( E )
-template <int N, typename E>
-struct Simplify<Log<Exp<E, Const<N>>>> {
-  typedef typename Simplify<
-            Mul<
-              Const<N>,
-              Log<
-                typename Simplify<E>::Result
-              >
-            >
-          >::Result Result;
+template <int N, int ND, typename E>
+struct Rule<Log<Exp<E, Const<N, ND>>>> {
+  typedef Mul<Const<N, ND>, Log<E>> Result;
 };
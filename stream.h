@@ -0,0 +1,328 @@
+/* Streaming evaluation over memory-mapped files
+
+Point sets larger than memory are evaluated straight from a file: the input
+file is mapped into memory, the results are written into a mapped output file
+of one double per point, and nothing is copied in between unless the layout
+asks for it. The input holds doubles in one of two layouts:
+
+  records  every point is a record of a fixed number of doubles, variable id
+           is field field[id] of the record (array of structures)
+  columns  the file holds a fixed number of columns of n doubles each, one
+           after the other, variable id is column field[id]
+
+Both are read through a Strided accessor of access.h: columns are handed to
+the kernel where they are in the file, records are gathered into columns a
+tile at a time, in a buffer that stays in cache.
+
+The points are processed in windows of STREAM_WINDOW points, and every window
+in chunks by a WorkStealingPool. While a window is evaluated the kernel
+already reads the next one (MADV_WILLNEED). Once a window is done, writing its
+results back to disk is started and its pages are dropped from both mappings
+(MADV_DONTNEED), so the resident memory stays at a few windows whatever the
+size of the files. Dropped output pages stay in the page cache until they are
+written, so no results are lost.
+*/
+
+#pragma once
+
+#include "expression.h"
+#include "access.h"
+#include "parallel.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// default number of points per window: 8 MB per column
+enum { STREAM_WINDOW = 256 * PARALLEL_CHUNK };
+
+
+// a file mapped into memory, unmapped and closed on destruction
+class MappedFile {
+public:
+  // maps an existing file for reading
+  explicit MappedFile(const std::string &path)
+      : fd(-1), data(nullptr), length(0) {
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      fail("open", path);
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0) {
+      fail("stat", path);
+    }
+    length = status.st_size;
+    map(PROT_READ, path);
+  }
+
+  // creates a file of the given size, or truncates an existing one to it, and
+  // maps it for writing
+  MappedFile(const std::string &path, std::size_t size)
+      : fd(-1), data(nullptr), length(size) {
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      fail("open", path);
+    }
+
+    if (ftruncate(fd, size) != 0) {
+      fail("resize", path);
+    }
+    map(PROT_READ | PROT_WRITE, path);
+  }
+
+  ~MappedFile(void) {
+    if (data) {
+      munmap(data, length);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *bytes(void) const {
+    return data;
+  }
+
+  char *bytes(void) {
+    return data;
+  }
+
+  std::size_t size(void) const {
+    return length;
+  }
+
+  // the whole file is going to be read from front to back
+  void sequential(void) {
+    advise(0, length, MADV_SEQUENTIAL);
+  }
+
+  // start reading the bytes [offset, offset + count) from disk
+  void willNeed(std::size_t offset, std::size_t count) {
+    advise(offset, count, MADV_WILLNEED);
+  }
+
+  // start writing the bytes [offset, offset + count) to disk, without waiting
+  void writeBack(std::size_t offset, std::size_t count) {
+#ifdef __linux__
+    sync_file_range(fd, offset, count, SYNC_FILE_RANGE_WRITE);
+#else
+    std::size_t begin = offset / pageSize() * pageSize();
+    if (count) {
+      msync(data + begin, offset + count - begin, MS_ASYNC);
+    }
+#endif
+  }
+
+  // drop the pages of the bytes [offset, offset + count) from the mapping;
+  // they are read again from the file when they are touched again
+  void release(std::size_t offset, std::size_t count) {
+    advise(offset, count, MADV_DONTNEED);
+  }
+
+private:
+  static std::size_t pageSize(void) {
+    static const std::size_t size = sysconf(_SC_PAGESIZE);
+    return size;
+  }
+
+  void map(int protection, const std::string &path) {
+    // mapping nothing is an error, so empty files are not mapped
+    if (length == 0) {
+      return;
+    }
+
+    void *address = mmap(nullptr, length, protection, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED) {
+      fail("map", path);
+    }
+    data = static_cast<char *>(address);
+  }
+
+  // advice on the pages that overlap the bytes [offset, offset + count); the
+  // advice is only a hint, so failing is not an error
+  void advise(std::size_t offset, std::size_t count, int advice) {
+    if (count == 0 || !data) {
+      return;
+    }
+
+    std::size_t begin = offset / pageSize() * pageSize();
+    std::size_t end = offset + count < length ? offset + count : length;
+    madvise(data + begin, end - begin, advice);
+  }
+
+  // throws the error of errno, after closing the file: the destructor is not
+  // called for an object whose constructor throws
+  void fail(const char *what, const std::string &path) {
+    int error = errno;
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+    throw std::system_error(error, std::generic_category(),
+                            std::string("cannot ") + what + " " + path);
+  }
+
+  int fd;
+  char *data;
+  std::size_t length;
+};
+
+
+enum StreamOrder { STREAM_RECORDS, STREAM_COLUMNS };
+
+// where the values of the variables are in the input, see the comment at the
+// top; for instance records of 4 doubles with x, y and z in the fields 0, 1
+// and 3 are {STREAM_RECORDS, 4, {0, 1, 3}}
+struct StreamLayout {
+  StreamOrder order;
+  // doubles per record, or number of columns
+  unsigned int fields;
+  // field or column of every variable, negative for those not in the file
+  int field[VARS_count];
+
+  // number of points in a file of the given size
+  std::size_t points(std::size_t bytes) const {
+    for (unsigned int id = 0; id < VARS_count; ++id) {
+      if (field[id] >= (int) fields) {
+        throw std::invalid_argument("stream layout: field " + std::to_string(field[id]) +
+                                    " of " + varname(id) + " is not below " +
+                                    std::to_string(fields));
+      }
+    }
+
+    std::size_t stride = fields * sizeof(double);
+    if (stride == 0 || bytes % stride != 0) {
+      throw std::invalid_argument("stream layout: " + std::to_string(bytes) +
+                                  " bytes are not a whole number of " +
+                                  std::to_string(stride) + " byte " +
+                                  (order == STREAM_RECORDS ? "records" : "rows"));
+    }
+    return bytes / stride;
+  }
+
+  // byte offset of the value of variable id for point 0, in a file of n points
+  std::size_t base(unsigned int id, std::size_t n) const {
+    return order == STREAM_RECORDS ? field[id] * sizeof(double)
+                                   : field[id] * n * sizeof(double);
+  }
+
+  // bytes from one point to the next
+  std::size_t stride(void) const {
+    return order == STREAM_RECORDS ? fields * sizeof(double) : sizeof(double);
+  }
+
+  // the points of a file of n points mapped at data
+  Strided<double> access(const char *data, std::size_t n) const {
+    Strided<double> result;
+    result.base = reinterpret_cast<const double *>(data);
+    result.stride = stride() / sizeof(double);
+    for (unsigned int id = 0; id < VARS_count; ++id) {
+      result.offset[id] = field[id] < 0 ? -1 : (std::ptrdiff_t) (base(id, n) / sizeof(double));
+    }
+    return result;
+  }
+};
+
+
+// evaluation of a file of points with any kernel providing
+//   static void evalBatch(const double *const *vars, std::size_t n, double *out)
+// like ParallelEval<>
+template <typename Kernel>
+struct StreamEval {
+  // evaluates every point of the input file and writes the results to the
+  // output file, which is created or overwritten; returns the number of points
+  static std::size_t evalFile(WorkStealingPool &pool, const std::string &input,
+                              const StreamLayout &layout, const std::string &output,
+                              std::size_t window = STREAM_WINDOW,
+                              std::size_t chunk = PARALLEL_CHUNK) {
+    MappedFile in(input);
+    std::size_t n = layout.points(in.size());
+    MappedFile out(output, n * sizeof(double));
+
+    in.sequential();
+    prefetch(in, layout, n, 0, window < n ? window : n);
+
+    for (std::size_t begin = 0; begin < n; begin += window) {
+      std::size_t end = n - begin < window ? n : begin + window;
+
+      // the next window is read while this one is evaluated
+      std::size_t next = n - end < window ? n : end + window;
+      prefetch(in, layout, n, end, next);
+
+      const char *bytes = in.bytes();
+      double *results = reinterpret_cast<double *>(out.bytes());
+      parallelFor(pool, end - begin, chunk, [&](std::size_t start, std::size_t len) {
+        Strided<double> points = layout.access(bytes, n);
+        points.base += (begin + start) * points.stride;
+        AccessEval<Kernel>::evalBatch(points, len, results + begin + start);
+      });
+
+      release(in, layout, n, begin, end);
+      out.writeBack(begin * sizeof(double), (end - begin) * sizeof(double));
+      out.release(begin * sizeof(double), (end - begin) * sizeof(double));
+    }
+
+    return n;
+  }
+
+  // with a pool of the given number of threads for this evaluation only
+  static std::size_t evalFile(const std::string &input, const StreamLayout &layout,
+                              const std::string &output, unsigned int threads = 0,
+                              std::size_t window = STREAM_WINDOW,
+                              std::size_t chunk = PARALLEL_CHUNK) {
+    WorkStealingPool pool(threads);
+    return evalFile(pool, input, layout, output, window, chunk);
+  }
+
+  static std::string toString(void) {
+    return Kernel::toString();
+  }
+
+private:
+  // the bytes of the input that hold the points [begin, end): one range for
+  // records, one per column for columns
+  template <typename Action>
+  static void ranges(const StreamLayout &layout, std::size_t n,
+                     std::size_t begin, std::size_t end, Action action) {
+    if (begin == end) {
+      return;
+    }
+
+    if (layout.order == STREAM_RECORDS) {
+      action(begin * layout.stride(), (end - begin) * layout.stride());
+      return;
+    }
+
+    for (unsigned int id = 0; id < VARS_count; ++id) {
+      if (layout.field[id] >= 0) {
+        action(layout.base(id, n) + begin * sizeof(double), (end - begin) * sizeof(double));
+      }
+    }
+  }
+
+  static void prefetch(MappedFile &in, const StreamLayout &layout, std::size_t n,
+                       std::size_t begin, std::size_t end) {
+    ranges(layout, n, begin, end, [&](std::size_t offset, std::size_t count) {
+      in.willNeed(offset, count);
+    });
+  }
+
+  static void release(MappedFile &in, const StreamLayout &layout, std::size_t n,
+                      std::size_t begin, std::size_t end) {
+    ranges(layout, n, begin, end, [&](std::size_t offset, std::size_t count) {
+      in.release(offset, count);
+    });
+  }
+};
@@ -0,0 +1,106 @@
+/* Higher derivatives and Taylor expansions
+
+The derivative of order K is taken from the simplified derivative of order
+K - 1, so every order is derived once, and the compiler keeps each order for
+all orders above it and for all expansions that need it.
+
+The Taylor coefficients of E in variable D at a point are
+  c_k = 1 / k! * d^k/dD^k E    for k = 0 .. K
+where the factor 1 / k! is a rational constant that is simplified into the
+derivative. All coefficients are evaluated in one sweep with a Bundle (see
+cse.h), such that the terms the orders share are computed once. Near the
+point, E is then approximated by the polynomial
+  E(a + h) ~ c_0 + c_1 h + ... + c_K h^K
+which only costs K multiplications and additions per evaluation.
+*/
+
+#pragma once
+
+#include "expression.h"
+#include "simplify.h"
+#include "derivative.h"
+#include "cse.h"
+
+
+// derivative of order K of E with respect to variable D, order 0 is E itself
+template <typename E, typename D, unsigned int K>
+struct NthDerivative {
+  typedef typename Derivative<
+            typename NthDerivative<E, D, K - 1>::Result,
+            D
+          >::Result Result;
+};
+
+template <typename E, typename D>
+struct NthDerivative<E, D, 0> {
+  typedef typename Simplify<E>::Result Result;
+};
+
+
+constexpr int factorial(unsigned int k) {
+  return k == 0 ? 1 : k * factorial(k - 1);
+}
+
+// Taylor coefficient of order K: 1 / K! * d^K/dD^K E
+template <typename E, typename D, unsigned int K>
+struct TaylorCoefficient {
+  static_assert(K <= 12, "K! has to fit in an int");
+
+  typedef typename Simplify<
+            Mul<
+              Const<1, factorial(K)>,
+              typename NthDerivative<E, D, K>::Result
+            >
+          >::Result Result;
+};
+
+
+// the bundle of the Taylor coefficients of orders 0 .. K, followed by Cs
+template <typename E, typename D, unsigned int K, typename... Cs>
+struct TaylorBundle {
+  typedef typename TaylorBundle<
+            E, D, K - 1,
+            typename TaylorCoefficient<E, D, K>::Result, Cs...
+          >::Result Result;
+};
+
+template <typename E, typename D, typename... Cs>
+struct TaylorBundle<E, D, 0, Cs...> {
+  typedef Bundle<typename TaylorCoefficient<E, D, 0>::Result, Cs...> Result;
+};
+
+
+// Taylor expansion of order K of E in variable D
+template <typename E, typename D, unsigned int K>
+struct Taylor {
+  typedef typename TaylorBundle<E, D, K>::Result Coefficients;
+
+  enum { order = K, size = K + 1 };
+
+  // coeffs[k] is set to the coefficient of order k at the point args
+  template <typename Args>
+  static void eval(const Args &args, typename ScalarOf<Args>::Type *coeffs) {
+    Coefficients::eval(args, coeffs);
+  }
+
+  // coeffs[k][i] is set to the coefficient of order k at point i of the
+  // columns vars
+  template <typename T>
+  static void evalBatch(const T *const *vars, std::size_t n, T *const *coeffs) {
+    Coefficients::evalBatch(vars, n, coeffs);
+  }
+
+  // approximate value of E where D is h away from the point of coeffs
+  template <typename T>
+  static T approximate(const T *coeffs, T h) {
+    T result = coeffs[K];
+    for (unsigned int k = K; k > 0; --k) {
+      result = result * h + coeffs[k - 1];
+    }
+    return result;
+  }
+
+  static std::string toString(void) {
+    return Coefficients::toString();
+  }
+};